@@ -0,0 +1,304 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+/*
+  The dictionary is one flat array of packed words. Each word is packed into
+  a word_key (5 bits per letter, first letter in the high bits), so the
+  whole word list is a single allocation of 4 bytes per word, or 8 for words
+  of more than 6 letters, and a word is only turned back into a string when
+  something needs to print or compare characters.
+
+  How long words are is fixed when the server is built, with -DWORD_LEN=n
+  for n from 4 to 8 (5 if it is not given), so every loop over a word's
+  letters has a constant bound and is unrolled, and the keys are only as
+  wide as that length needs. A server only plays dictionaries of its own
+  length, and readDict() tells the length to build for when it is given
+  another.
+
+  Next to the array sits a hashed index used to validate guesses: an
+  open-addressed table with linear probing, keyed on the packed word and
+  sized so it is never more than half full. Both are built once by
+  readDict() before the server goes live and never change afterwards, so
+  threads can read them without taking any locks.
+  A probe hashes the key straight to a slot and compares integers; a hit is
+  almost always found in the first slot, and a miss stops at the first empty
+  one, which is usually in the same cache line.
+*/
+
+#ifndef WORD_LEN
+#define WORD_LEN 5
+#endif
+#define MIN_WORD_LEN 4
+#define MAX_WORD_LEN 8
+#if WORD_LEN < MIN_WORD_LEN || WORD_LEN > MAX_WORD_LEN
+#error "WORD_LEN has to be from 4 to 8"
+#endif
+
+// Up to 6 letters fit in 32 bits.
+#if WORD_LEN <= 6
+typedef uint32_t word_key;
+#define NO_KEY UINT32_MAX
+#else
+typedef uint64_t word_key;
+#define NO_KEY UINT64_MAX
+#endif
+
+// What is sent in place of a word there is none for, which no word is.
+#if WORD_LEN == 4
+#define NO_WORD_TEXT "????"
+#elif WORD_LEN == 5
+#define NO_WORD_TEXT "?????"
+#elif WORD_LEN == 6
+#define NO_WORD_TEXT "??????"
+#elif WORD_LEN == 7
+#define NO_WORD_TEXT "???????"
+#else
+#define NO_WORD_TEXT "????????"
+#endif
+
+// Loops over the letters of a word are unrolled whatever -O says.
+#define UNROLL_WORD _Pragma("GCC unroll 8")
+
+// A dictionary position that is not one.
+#define NO_WORD UINT32_MAX
+// Most words a dictionary can have, so its index (twice as many slots) has
+// a power of two size that fits in 32 bits.
+#define DICT_MAX_WORDS (1 << 30)
+#define DICT_BLOCK_SIZE 65536
+// Longest word readDict() keeps whole for its error message.
+#define DICT_WORD_SIZE 257
+
+struct DictSlot {
+    word_key key; // packed word, or NO_KEY if the slot is empty
+    uint32_t pos; // index of that word in the dictionary
+};
+
+struct DictIndex {
+    struct DictSlot *slots;
+    uint32_t mask;
+    int shift;
+};
+
+struct Dictionary {
+    word_key *words; // packed words, in file order
+    int size;
+    struct DictIndex index;
+};
+
+// Packs a WORD_LEN letter word into an integer key. Case is ignored.
+// Returns NO_KEY if the word is not exactly WORD_LEN letters long.
+static inline word_key packWord(const char *word) {
+    word_key key = 0;
+    UNROLL_WORD
+    for (int i = 0; i < WORD_LEN; i++) {
+        unsigned c = (unsigned char)(word[i] | 0x20) - 'a';
+        if (c >= 26)
+            return NO_KEY;
+        key = (key << 5) | c;
+    }
+    if (word[WORD_LEN] != '\0')
+        return NO_KEY;
+    return key;
+}
+
+// Writes the lowercase, null terminated word for key into out
+// (WORD_LEN + 1 bytes).
+static inline void unpackWord(word_key key, char *out) {
+    UNROLL_WORD
+    for (int i = WORD_LEN - 1; i >= 0; i--) {
+        out[i] = 'a' + (key & 31);
+        key >>= 5;
+    }
+    out[WORD_LEN] = '\0';
+}
+
+// Returns how many letters word has, or 0 if it is not a word of a length
+// a server can be built for.
+static inline int wordLength(const char *word) {
+    int len = 0;
+    while (isalpha((unsigned char)word[len]) && len <= MAX_WORD_LEN)
+        len++;
+    if (word[len] != '\0' || len < MIN_WORD_LEN || len > MAX_WORD_LEN)
+        return 0;
+    return len;
+}
+
+// Fibonacci hashing, keeps the top bits of the product.
+static inline uint32_t hashWord(const struct DictIndex *index, word_key key) {
+#if WORD_LEN <= 6
+    return (uint32_t)(key * 2654435769u) >> index->shift;
+#else
+    return (uint32_t)(key * 0x9e3779b97f4a7c15ull >> 32) >> index->shift;
+#endif
+}
+
+// Returns the dictionary position of the packed word key, or NO_WORD if it
+// is not in the index.
+static inline uint32_t lookupKey(const struct DictIndex *index, word_key key) {
+    uint32_t i = hashWord(index, key);
+    while (index->slots[i].key != NO_KEY) {
+        if (index->slots[i].key == key)
+            return index->slots[i].pos;
+        i = (i + 1) & index->mask;
+    }
+    return NO_WORD;
+}
+
+// Returns the dictionary position of word, or NO_WORD if it is not in the
+// dictionary.
+static inline uint32_t lookupWord(const struct Dictionary *dict,
+                                  const char *word) {
+    word_key key = packWord(word);
+    if (key == NO_KEY)
+        return NO_WORD;
+    return lookupKey(&dict->index, key);
+}
+
+// Allocates an empty dictionary with room for words entries, from 1 to
+// DICT_MAX_WORDS.
+// Returns false if that is too many or too few, or an allocation failed.
+static inline bool newDict(struct Dictionary *dict, int words) {
+    if (words < 1 || words > DICT_MAX_WORDS)
+        return false;
+    uint32_t size = 2;
+    int bits = 1;
+    while (size < 2 * (uint32_t)words) {
+        size <<= 1;
+        bits++;
+    }
+    dict->size = 0;
+    dict->words = malloc(words * sizeof(word_key));
+    dict->index.slots = malloc(size * sizeof(struct DictSlot));
+    if (dict->words == NULL || dict->index.slots == NULL) {
+        free(dict->words);
+        free(dict->index.slots);
+        dict->words = NULL;
+        dict->index.slots = NULL;
+        return false;
+    }
+    // NO_KEY is all ones, so this marks every slot empty.
+    memset(dict->index.slots, 0xff, size * sizeof(struct DictSlot));
+    dict->index.mask = size - 1;
+    dict->index.shift = 32 - bits;
+    return true;
+}
+
+// Appends the packed word key to the dictionary. Duplicates keep their
+// place in the array, but the index only points at the first one.
+// The caller is responsible for not adding more words than newDict() made
+// room for.
+static inline void addWord(struct Dictionary *dict, word_key key) {
+    uint32_t pos = dict->size++;
+    dict->words[pos] = key;
+
+    uint32_t i = hashWord(&dict->index, key);
+    while (dict->index.slots[i].key != NO_KEY) {
+        if (dict->index.slots[i].key == key)
+            return;
+        i = (i + 1) & dict->index.mask;
+    }
+    dict->index.slots[i].key = key;
+    dict->index.slots[i].pos = pos;
+}
+
+static inline void freeDict(struct Dictionary *dict) {
+    free(dict->words);
+    free(dict->index.slots);
+    dict->words = NULL;
+    dict->index.slots = NULL;
+    dict->size = 0;
+}
+
+// Reads the first dict_size words of dict_in into dict. Every word has to be
+// exactly WORD_LEN letters.
+// The file is read in large blocks and split on whitespace by hand, which is
+// much faster than one fscanf() per word on big word lists.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+static inline int readDict(FILE *dict_in, struct Dictionary *dict,
+                           int dict_size) {
+    if (dict_size < 1 || dict_size > DICT_MAX_WORDS) {
+        fprintf(stderr, "ERROR: a dictionary has from 1 to %d words\n",
+                DICT_MAX_WORDS);
+        return EXIT_FAILURE;
+    }
+    if (!newDict(dict, dict_size)) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    char *block = malloc(DICT_BLOCK_SIZE);
+    if (block == NULL) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        freeDict(dict);
+        return EXIT_FAILURE;
+    }
+
+    // The word currently being read, which may straddle two blocks.
+    char word_buffer[DICT_WORD_SIZE];
+    int len = 0;
+    size_t numread;
+    bool eof = false;
+
+    while (dict->size < dict_size && !eof) {
+        numread = fread(block, sizeof(char), DICT_BLOCK_SIZE, dict_in);
+        if (numread < DICT_BLOCK_SIZE) {
+            if (ferror(dict_in)) {
+                perror("ERROR: fread() failed");
+                free(block);
+                freeDict(dict);
+                return EXIT_FAILURE;
+            }
+            eof = true;
+            // Treat the end of the file as whitespace so the last word
+            // gets added.
+            *(block + numread++) = '\n';
+        }
+
+        for (size_t i = 0; i < numread && dict->size < dict_size; i++) {
+            if (!isspace((unsigned char)*(block + i))) {
+                if (len < DICT_WORD_SIZE - 1)
+                    word_buffer[len++] = *(block + i);
+                continue;
+            }
+            if (len == 0)
+                continue;
+
+            word_buffer[len] = '\0';
+            len = 0;
+            // All words in the dictionary should only be this long...
+            word_key key = packWord(word_buffer);
+            if (key == NO_KEY) {
+                fprintf(stderr, "ERROR: \"%s\" is not a word of %d letters\n",
+                        word_buffer, WORD_LEN);
+                int other = dict->size == 0 ? wordLength(word_buffer) : 0;
+                if (other != 0)
+                    fprintf(stderr,
+                            "ERROR: the dictionary is of %d letter words, "
+                            "build with -DWORD_LEN=%d to play it\n",
+                            other, other);
+                free(block);
+                freeDict(dict);
+                return EXIT_FAILURE;
+            }
+            addWord(dict, key);
+        }
+    }
+
+    // this is only needed for dictionary population
+    free(block);
+
+    if (dict->size < dict_size) {
+        fprintf(stderr, "ERROR: Failed to read before EOF\n");
+        freeDict(dict);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+/*
+  Telling when an old copy of something shared has no readers left, so it
+  can be freed, without the readers ever taking a lock.
+  Every copy carries an epoch. A reader counts itself into the copy's epoch
+  when it starts using the copy and out again when it is done, and the copy
+  is quiet once the two counts match. Same as the counters in Stats.h, the
+  counts are split over cache-line sized slots and every thread keeps to
+  one, so entering and leaving are one uncontended atomic add each, however
+  long the reader holds on to the copy.
+  The writer publishes a new copy by swapping the pointer readers look it up
+  through. A reader that looked the old copy up just before the swap may
+  not have counted itself in yet, so looking up and counting in are done
+  inside a second epoch that belongs to the pointer and is never freed.
+  Once that one has been quiet after the swap, every reader that found the
+  old copy is counted in it, and the old copy can go as soon as it is quiet.
+  Every operation is sequentially consistent, which is what makes "quiet
+  after the swap" mean anything; entering and leaving are read-modify-write
+  operations that cost the same either way.
+*/
+
+#define EPOCH_SLOTS 64
+#define EPOCH_LINE 64
+
+struct EpochSlot {
+    _Alignas(EPOCH_LINE) atomic_ullong entered;
+    atomic_ullong left;
+};
+
+struct Epoch {
+    struct EpochSlot slots[EPOCH_SLOTS];
+};
+
+// A thread uses the same slot in every epoch.
+static __thread int epoch_slot = -1;
+static atomic_uint next_epoch_slot;
+
+static inline struct EpochSlot *myEpochSlot(struct Epoch *epoch) {
+    if (epoch_slot < 0)
+        epoch_slot = atomic_fetch_add_explicit(&next_epoch_slot, 1,
+                                               memory_order_relaxed) %
+                     EPOCH_SLOTS;
+    return &epoch->slots[epoch_slot];
+}
+
+static inline void enterEpoch(struct Epoch *epoch) {
+    atomic_fetch_add(&myEpochSlot(epoch)->entered, 1);
+}
+
+static inline void leaveEpoch(struct Epoch *epoch) {
+    atomic_fetch_add(&myEpochSlot(epoch)->left, 1);
+}
+
+// Whether every reader that had counted itself in by now has counted itself
+// out. The readers that left are added up before the ones that entered, so
+// one that comes and goes in between can only make it look busier.
+static inline bool quietEpoch(struct Epoch *epoch) {
+    unsigned long long left = 0;
+    unsigned long long entered = 0;
+    for (int i = 0; i < EPOCH_SLOTS; i++)
+        left += atomic_load(&epoch->slots[i].left);
+    for (int i = 0; i < EPOCH_SLOTS; i++)
+        entered += atomic_load(&epoch->slots[i].entered);
+    return left == entered;
+}
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef HINT_H
+#define HINT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Dictionary.h"
+#include "Matrix.h"
+#include "Thread.h"
+#include "Wordle.h"
+/*
+  Suggests the next guess for a game: the dictionary word whose feedback
+  tells the player the most about the answer, given what the guesses so far
+  have already ruled out.
+
+  The words still possible are found by replaying the game's guesses: a
+  word stays in only if it would have produced the same feedback for every
+  one of them. Those candidates are kept as a bitset over the dictionary,
+  plus a list of their positions to walk.
+  Every dictionary word is then scored as a guess by how it would split the
+  candidates up by feedback pattern. The best guess has the highest
+  expected information (entropy), which is the same as the lowest sum of
+  c * log2(c) over the sizes c of the groups. Ties go to a guess that could
+  itself be the answer.
+
+  Scoring looks patterns up in the feedback matrix (see Matrix.h), which the
+  engine builds in memory when the server was not given one and the
+  dictionary is small enough. The guesses are split into chunks that the
+  calling thread works through together with a few helper threads, so one
+  suggestion is spread over several cores.
+  The first guess of a game does not depend on anything, so it is only
+  worked out once, at startup. The second one only depends on the first
+  guess and its feedback, and is the slowest to work out since the fewest
+  words have been ruled out by then, so those are remembered as they come
+  up. The replies to the suggested opening are all worked out at startup.
+  A caller that cannot wait for a suggestion, like an event loop with other
+  connections to get on with, hands it to the helper threads instead with
+  requestHint() and is called back once it is done. A helper works it out
+  the same way, with the others' help, after any suggestion already being
+  worked on.
+*/
+
+// A guess this is a request for a hint instead. It can never be a word.
+#define HINT_REQUEST NO_WORD_TEXT
+#define HINT_CHUNKS 64
+// Largest matrix the engine builds for itself, in bytes (about 8000 words,
+// or 5800 of more than 5 letters).
+#define HINT_MAX_MATRIX (64u << 20)
+// c * log2(c) is looked up for groups up to this size.
+#define HINT_COST_TABLE 65536
+// Most second guesses remembered (one per first guess and pattern).
+#define HINT_MAX_CACHE (16u << 20)
+
+struct HintPick {
+    double cost;
+    uint32_t guess;
+    bool candidate;
+};
+
+// One suggestion being worked out. Everything but the candidates is
+// protected by the engine's mutex.
+struct HintJob {
+    const uint64_t *cand_set;
+    const uint32_t *cands;
+    uint32_t num_cands;
+    int next_chunk;
+    int done_chunks;
+    struct HintPick picks[HINT_CHUNKS];
+    struct HintJob *next;
+};
+
+// A suggestion asked for with requestHint(). The guesses and patterns have
+// to stay put until it is done.
+struct HintRequest {
+    const uint32_t *guesses;
+    const pattern_code *patterns;
+    int count;
+    uint32_t hint; // the suggestion, once it is done
+    // Called once hint is filled in, on a helper thread; the engine is done
+    // with the request by then.
+    void (*done)(struct HintRequest *request);
+    struct HintRequest *next;
+};
+
+struct HintEngine {
+    const struct Dictionary *dict;
+    const pattern_code *codes; // pattern matrix, or NULL to score as we go
+    pattern_code *own_codes;   // the matrix, if the engine had to build it
+    double *cost;
+    uint32_t cost_size;
+    uint32_t opening;
+    // The best second guess for each first guess and pattern, NO_WORD until
+    // it has been worked out.
+    _Atomic uint32_t *second;
+
+    pthread_t *helpers;
+    int num_helpers;
+    pthread_mutex_t mutex;
+    pthread_cond_t work; // a job was posted, or the engine is stopping
+    pthread_cond_t done; // a job's last chunk was finished
+    struct HintJob *jobs;
+    // Waiting for a helper, in the order they were asked for.
+    struct HintRequest *requests;
+    struct HintRequest *last_request;
+    bool stopping;
+};
+
+// log2(x) for x >= 1, so the engine does not need libm.
+static inline double hintLog2(double x) {
+    int e = 0;
+    while (x >= 2) {
+        x /= 2;
+        e++;
+    }
+    // ln(x) = 2 atanh(z) with z = (x - 1) / (x + 1) <= 1/3 here.
+    double z = (x - 1) / (x + 1), z2 = z * z, term = z, sum = 0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= z2;
+    }
+    return e + 2 * sum / 0.69314718055994530942;
+}
+
+static inline double groupCost(const struct HintEngine *engine, uint32_t c) {
+    return c < engine->cost_size ? engine->cost[c] : c * hintLog2(c);
+}
+
+static inline bool inSet(const uint64_t *set, uint32_t i) {
+    return (set[i / 64] >> (i % 64)) & 1;
+}
+
+// Scores the guesses in one chunk against the job's candidates.
+static void scoreHintChunk(struct HintEngine *engine, struct HintJob *job,
+                           int chunk) {
+    const struct Dictionary *dict = engine->dict;
+    size_t n = dict->size;
+    uint32_t first = n * chunk / HINT_CHUNKS;
+    uint32_t last = n * (chunk + 1) / HINT_CHUNKS;
+    uint32_t counts[NUM_PATTERNS] = {0};
+    pattern_code touched[NUM_PATTERNS];
+    struct HintPick best = {0, NO_WORD, false};
+
+    for (uint32_t g = first; g < last; g++) {
+        int num_touched = 0;
+        if (engine->codes != NULL) {
+            const pattern_code *row = engine->codes + g * n;
+            for (uint32_t i = 0; i < job->num_cands; i++) {
+                pattern_code p = row[job->cands[i]];
+                if (counts[p]++ == 0)
+                    touched[num_touched++] = p;
+            }
+        } else {
+            word_key guess = *(dict->words + g);
+            for (uint32_t i = 0; i < job->num_cands; i++) {
+                pattern_code p =
+                    scoreGuess(*(dict->words + job->cands[i]), guess);
+                if (counts[p]++ == 0)
+                    touched[num_touched++] = p;
+            }
+        }
+
+        double cost = 0;
+        for (int k = 0; k < num_touched; k++) {
+            cost += groupCost(engine, counts[touched[k]]);
+            counts[touched[k]] = 0;
+        }
+        bool candidate = inSet(job->cand_set, g);
+        if (best.guess == NO_WORD || cost < best.cost ||
+            (cost == best.cost && candidate && !best.candidate)) {
+            best.cost = cost;
+            best.guess = g;
+            best.candidate = candidate;
+        }
+    }
+    job->picks[chunk] = best;
+}
+
+// Takes the next chunk of job to score. Must hold the engine's mutex.
+// Returns -1 if every chunk has been taken.
+static int claimHintChunk(struct HintEngine *engine, struct HintJob *job) {
+    if (job->next_chunk == HINT_CHUNKS)
+        return -1;
+    int chunk = job->next_chunk++;
+    if (job->next_chunk == HINT_CHUNKS) {
+        // Nobody needs to find this job any more.
+        struct HintJob **link = &engine->jobs;
+        while (*link != job)
+            link = &(*link)->next;
+        *link = job->next;
+    }
+    return chunk;
+}
+
+// Scores one chunk and reports it done. Must be called with the engine's
+// mutex held, which is released while scoring.
+static void runHintChunk(struct HintEngine *engine, struct HintJob *job,
+                         int chunk) {
+    pthread_mutex_unlock(&engine->mutex);
+    scoreHintChunk(engine, job, chunk);
+    pthread_mutex_lock(&engine->mutex);
+    if (++job->done_chunks == HINT_CHUNKS)
+        pthread_cond_broadcast(&engine->done);
+}
+
+static inline uint32_t suggestGuess(struct HintEngine *engine,
+                                    const uint32_t *guesses,
+                                    const pattern_code *patterns, int count);
+
+// Helps with the suggestions being worked out, and takes on the next one
+// that was asked for with requestHint() once there are none.
+static void *hintHelper(void *arg) {
+    struct HintEngine *engine = arg;
+    pthread_mutex_lock(&engine->mutex);
+    for (;;) {
+        while (!engine->stopping && engine->jobs == NULL &&
+               engine->requests == NULL)
+            pthread_cond_wait(&engine->work, &engine->mutex);
+        if (engine->stopping)
+            break;
+        if (engine->jobs != NULL) {
+            struct HintJob *job = engine->jobs;
+            runHintChunk(engine, job, claimHintChunk(engine, job));
+            continue;
+        }
+        struct HintRequest *request = engine->requests;
+        engine->requests = request->next;
+        if (engine->requests == NULL)
+            engine->last_request = NULL;
+        pthread_mutex_unlock(&engine->mutex);
+        request->hint = suggestGuess(engine, request->guesses,
+                                     request->patterns, request->count);
+        request->done(request);
+        pthread_mutex_lock(&engine->mutex);
+    }
+    pthread_mutex_unlock(&engine->mutex);
+    return NULL;
+}
+
+// The best guess against the num_cands candidates in cands (and cand_set).
+static uint32_t bestHint(struct HintEngine *engine, const uint64_t *cand_set,
+                         const uint32_t *cands, uint32_t num_cands) {
+    struct HintJob job;
+    memset(&job, 0, sizeof(job));
+    job.cand_set = cand_set;
+    job.cands = cands;
+    job.num_cands = num_cands;
+
+    pthread_mutex_lock(&engine->mutex);
+    {
+        struct HintJob **link = &engine->jobs;
+        while (*link != NULL)
+            link = &(*link)->next;
+        *link = &job;
+        pthread_cond_broadcast(&engine->work);
+
+        int chunk;
+        while ((chunk = claimHintChunk(engine, &job)) != -1)
+            runHintChunk(engine, &job, chunk);
+        while (job.done_chunks < HINT_CHUNKS)
+            pthread_cond_wait(&engine->done, &engine->mutex);
+    }
+    pthread_mutex_unlock(&engine->mutex);
+
+    struct HintPick best = {0, NO_WORD, false};
+    for (int i = 0; i < HINT_CHUNKS; i++) {
+        struct HintPick *pick = &job.picks[i];
+        if (pick->guess == NO_WORD)
+            continue;
+        if (best.guess == NO_WORD || pick->cost < best.cost ||
+            (pick->cost == best.cost && pick->candidate && !best.candidate))
+            best = *pick;
+    }
+    return best.guess;
+}
+
+// Where the best second guess after the first one in guesses is kept, or
+// NULL if it is not a second guess or they are not kept.
+static inline _Atomic uint32_t *secondHint(struct HintEngine *engine,
+                                           const uint32_t *guesses,
+                                           const pattern_code *patterns,
+                                           int count) {
+    if (count != 1 || engine->second == NULL)
+        return NULL;
+    return engine->second + (size_t)guesses[0] * NUM_PATTERNS + patterns[0];
+}
+
+// Looks up the suggestion for a game that has made count guesses so far
+// (see suggestGuess()) in what the engine already knows: the opening, and
+// the second guesses it has worked out.
+// Returns false if it has to be worked out, and sets *hint otherwise.
+static inline bool knownHint(struct HintEngine *engine,
+                             const uint32_t *guesses,
+                             const pattern_code *patterns, int count,
+                             uint32_t *hint) {
+    if (count == 0 && engine->opening != NO_WORD) {
+        *hint = engine->opening;
+        return true;
+    }
+    _Atomic uint32_t *cached = secondHint(engine, guesses, patterns, count);
+    if (cached == NULL)
+        return false;
+    *hint = atomic_load_explicit(cached, memory_order_relaxed);
+    return *hint != NO_WORD;
+}
+
+// Suggests the next guess for a game that has made count guesses so far,
+// given as dictionary positions with the pattern code each one got back.
+// Returns a dictionary position, or NO_WORD if no word fits the feedback
+// or the engine ran out of memory.
+static inline uint32_t suggestGuess(struct HintEngine *engine,
+                                    const uint32_t *guesses,
+                                    const pattern_code *patterns, int count) {
+    uint32_t guess;
+    if (knownHint(engine, guesses, patterns, count, &guess))
+        return guess;
+    _Atomic uint32_t *cached = secondHint(engine, guesses, patterns, count);
+
+    const struct Dictionary *dict = engine->dict;
+    size_t n = dict->size;
+    uint64_t *cand_set = calloc((n + 63) / 64, sizeof(uint64_t));
+    uint32_t *cands = malloc(n * sizeof(uint32_t));
+    if (cand_set == NULL || cands == NULL) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        free(cand_set);
+        free(cands);
+        return NO_WORD;
+    }
+
+    uint32_t num_cands = 0;
+    for (uint32_t t = 0; t < n; t++) {
+        bool fits = true;
+        for (int i = 0; i < count && fits; i++) {
+            pattern_code p = engine->codes != NULL
+                            ? engine->codes[guesses[i] * n + t]
+                            : scoreGuess(*(dict->words + t),
+                                         *(dict->words + guesses[i]));
+            fits = p == patterns[i];
+        }
+        if (fits) {
+            cand_set[t / 64] |= (uint64_t)1 << (t % 64);
+            cands[num_cands++] = t;
+        }
+    }
+
+    guess = NO_WORD;
+    if (num_cands <= 2) {
+        // Nothing left to learn, go for the win.
+        if (num_cands > 0)
+            guess = cands[0];
+    } else {
+        guess = bestHint(engine, cand_set, cands, num_cands);
+    }
+    free(cand_set);
+    free(cands);
+    // Two threads working the same one out at once just store the same
+    // answer.
+    if (cached != NULL)
+        atomic_store_explicit(cached, guess, memory_order_relaxed);
+    return guess;
+}
+
+// Has a helper thread work out the suggestion for request and call its
+// done(), so the caller does not have to wait for it. An engine without
+// helpers works it out there and then.
+static inline void requestHint(struct HintEngine *engine,
+                               struct HintRequest *request) {
+    if (engine->num_helpers == 0) {
+        request->hint = suggestGuess(engine, request->guesses,
+                                     request->patterns, request->count);
+        request->done(request);
+        return;
+    }
+    request->next = NULL;
+    pthread_mutex_lock(&engine->mutex);
+    {
+        if (engine->last_request != NULL)
+            engine->last_request->next = request;
+        else
+            engine->requests = request;
+        engine->last_request = request;
+        pthread_cond_signal(&engine->work);
+    }
+    pthread_mutex_unlock(&engine->mutex);
+}
+
+// Stops the helpers and frees the engine. Nothing may be waiting on a
+// requestHint() any more.
+static inline void stopHints(struct HintEngine *engine) {
+    pthread_mutex_lock(&engine->mutex);
+    engine->stopping = true;
+    pthread_cond_broadcast(&engine->work);
+    pthread_mutex_unlock(&engine->mutex);
+    for (int i = 0; i < engine->num_helpers; i++)
+        pthread_join(*(engine->helpers + i), NULL);
+
+    pthread_mutex_destroy(&engine->mutex);
+    pthread_cond_destroy(&engine->work);
+    pthread_cond_destroy(&engine->done);
+    free(engine->helpers);
+    free(engine->second);
+    free(engine->own_codes);
+    free(engine->cost);
+    memset(engine, 0, sizeof(struct HintEngine));
+}
+
+// Gets the engine ready to make suggestions for games on dict, with that
+// many helper threads. matrix may have no codes loaded, in which case the
+// engine builds its own if the dictionary is small enough.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+static inline int startHints(struct HintEngine *engine,
+                             const struct Dictionary *dict,
+                             const struct Matrix *matrix, int helpers) {
+    size_t n = dict->size;
+
+    memset(engine, 0, sizeof(struct HintEngine));
+    engine->dict = dict;
+    engine->opening = NO_WORD;
+    pthread_mutex_init(&engine->mutex, NULL);
+    pthread_cond_init(&engine->work, NULL);
+    pthread_cond_init(&engine->done, NULL);
+
+    engine->cost_size = n < HINT_COST_TABLE ? n + 1 : HINT_COST_TABLE;
+    engine->cost = malloc(engine->cost_size * sizeof(double));
+    engine->helpers = calloc(helpers > 0 ? helpers : 1, sizeof(pthread_t));
+    if (engine->cost == NULL || engine->helpers == NULL) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        stopHints(engine);
+        return EXIT_FAILURE;
+    }
+    for (uint32_t c = 0; c < engine->cost_size; c++)
+        engine->cost[c] = c < 2 ? 0 : c * hintLog2(c);
+
+    for (; engine->num_helpers < helpers; engine->num_helpers++) {
+        if (spawnHelper(engine->helpers + engine->num_helpers, hintHelper,
+                        engine) != 0) {
+            perror("ERROR: pthread_create() failed");
+            stopHints(engine);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (matrix->codes != NULL) {
+        engine->codes = matrix->codes;
+    } else if (n * n * sizeof(pattern_code) <= HINT_MAX_MATRIX) {
+        engine->own_codes = malloc(n * n * sizeof(pattern_code));
+        if (engine->own_codes != NULL &&
+            buildMatrix(dict, engine->own_codes, helpers + 1))
+            engine->codes = engine->own_codes;
+    }
+
+    if (n * NUM_PATTERNS <= HINT_MAX_CACHE) {
+        engine->second = malloc(n * NUM_PATTERNS * sizeof(uint32_t));
+        // NO_WORD is all ones.
+        if (engine->second != NULL)
+            memset(engine->second, 0xff, n * NUM_PATTERNS * sizeof(uint32_t));
+    }
+
+    engine->opening = suggestGuess(engine, NULL, NULL, 0);
+    if (engine->opening != NO_WORD && engine->codes != NULL &&
+        engine->second != NULL) {
+        const pattern_code *row =
+            engine->codes + (size_t)engine->opening * n;
+        for (uint32_t t = 0; t < n; t++)
+            suggestGuess(engine, &engine->opening, row + t, 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
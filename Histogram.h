@@ -0,0 +1,152 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+/*
+  A latency histogram in the style of HdrHistogram: log-linear buckets that
+  keep every value to within 2% of what was recorded, from 1 to 2^64, in a
+  fixed 30KB of counters.
+  Values below HIST_SUB_COUNT get a bucket each. Above that, every power of
+  two is split into HIST_SUB_COUNT / 2 equal buckets, so a bucket is never
+  wider than 1 / 64th of the values in it. Recording is a couple of shifts
+  and an add, and never allocates, so a thread can keep its own histogram
+  on the hot path and merge it into a total afterwards.
+*/
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 2) * (HIST_SUB_COUNT / 2))
+
+struct Histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+static inline void clearHist(struct Histogram *h) {
+    memset(h, 0, sizeof(struct Histogram));
+    h->min = UINT64_MAX;
+}
+
+// The bucket for value with sub_bits bits of precision. Smaller histograms
+// (see Latency.h) use the same layout with fewer bits.
+static inline int histBucketBits(uint64_t value, int sub_bits) {
+    if (value < (1u << sub_bits))
+        return value;
+    // Shift the value down until it has sub_bits bits, the top one set.
+    int shift = 64 - __builtin_clzll(value) - sub_bits;
+    return shift * (1 << (sub_bits - 1)) + (value >> shift);
+}
+
+// The largest value that lands in bucket, with sub_bits bits of precision.
+static inline uint64_t histBucketTopBits(int bucket, int sub_bits) {
+    int half = 1 << (sub_bits - 1);
+    if (bucket < 2 * half)
+        return bucket;
+    int shift = bucket / half - 1;
+    uint64_t sub = bucket - shift * half;
+    return ((sub + 1) << shift) - 1;
+}
+
+static inline int histBucket(uint64_t value) {
+    return histBucketBits(value, HIST_SUB_BITS);
+}
+
+static inline uint64_t histBucketTop(int bucket) {
+    return histBucketTopBits(bucket, HIST_SUB_BITS);
+}
+
+static inline void recordHist(struct Histogram *h, uint64_t value) {
+    h->counts[histBucket(value)]++;
+    h->total++;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+// Adds count values of value at once.
+static inline void recordHistCount(struct Histogram *h, uint64_t value,
+                                   uint64_t count) {
+    if (count == 0)
+        return;
+    h->counts[histBucket(value)] += count;
+    h->total += count;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+// Adds every value recorded in from to into.
+static inline void mergeHist(struct Histogram *into,
+                             const struct Histogram *from) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->min < into->min)
+        into->min = from->min;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+// Returns the value that percent of the recorded values are at or below
+// (to within a bucket), or 0 if nothing has been recorded.
+static inline uint64_t percentileHist(const struct Histogram *h,
+                                      double percent) {
+    if (h->total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(percent / 100 * h->total + 0.5);
+    uint64_t seen = 0;
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return histBucketTop(i) < h->max ? histBucketTop(i) : h->max;
+    }
+    return h->max;
+}
+
+// Prints one line of percentiles, with values divided by scale (for
+// nanoseconds recorded and microseconds printed, scale is 1000).
+static inline void printHist(FILE *out, const char *name,
+                             const struct Histogram *h, double scale) {
+    fprintf(out,
+            "%-12s %10llu  min %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  "
+            "p99.9 %9.1f  max %9.1f\n",
+            name, (unsigned long long)h->total,
+            h->total > 0 ? h->min / scale : 0.0,
+            percentileHist(h, 50) / scale, percentileHist(h, 90) / scale,
+            percentileHist(h, 99) / scale, percentileHist(h, 99.9) / scale,
+            h->max / scale);
+}
+
+// Prints the whole distribution the way HdrHistogram does: the value at
+// percentiles that close half the distance to 100% every two steps, with the
+// count at or below it and 1 / (1 - percentile).
+static inline void printHistDistribution(FILE *out, const struct Histogram *h,
+                                         double scale) {
+    fprintf(out, "%12s %14s %10s %16s\n", "Value", "Percentile", "TotalCount",
+            "1/(1-Percentile)");
+    if (h->total == 0)
+        return;
+
+    // Stops once what is left is less than one recorded value.
+    for (double left = 100; left * h->total >= 100;
+         left *= 0.7071067811865476) {
+        uint64_t value = percentileHist(h, 100 - left);
+        uint64_t count = 0;
+        for (int i = 0; i <= histBucket(value); i++)
+            count += h->counts[i];
+        fprintf(out, "%12.3f %14.12f %10llu %16.2f\n", value / scale,
+                (100 - left) / 100, (unsigned long long)count, 100 / left);
+    }
+    fprintf(out, "%12.3f %14.12f %10llu\n", h->max / scale, 1.0,
+            (unsigned long long)h->total);
+}
+
+#endif
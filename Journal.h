@@ -0,0 +1,525 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Thread.h"
+#include "WordLog.h"
+#include "Wordle.h"
+/*
+  A journal of every game the server plays, so that a server that dies can
+  be started again where it left off.
+  The journal is a file of 16 byte records, mapped into memory and only
+  ever appended to: a game starting (with its word), every valid guess
+  (with what it scored) and the game ending (won or lost). Appending claims
+  the next record with one atomic add on the file's header and fills it in,
+  with the record's type stored last, so a record that was never finished
+  reads as empty. The header is in the mapping too, so a server that is
+  being upgraded and the one taking over from it append to the same journal
+  without getting in each other's way.
+
+  Words longer than 6 letters and patterns longer than 5 spill their top
+  bits into what is otherwise padding, so a record stays 16 bytes whatever
+  the server was built for. The header says how long the journal's words
+  are, and a server built for another length will not open it.
+
+  Nothing waits on the disk while games are played. The records are in the
+  page cache as soon as they are written, where they survive the server
+  dying, and a syncer thread writes everything appended since its last pass
+  out to the disk every JOURNAL_SYNC_NS, as one msync() for all of it, so a
+  machine that goes down loses at most that much.
+
+  A game is known by a token, which is where its start record is in the
+  journal with 32 check bits on top that the server draws with a secret
+  key, so a client has to have been told it to use it. Reading the journal
+  back gives the guesses, wins and losses it holds and the words played, in
+  order, and every game it has no end for, for a client to take back up
+  with its token. A game that was actually over (its last guess won, or
+  used up the guesses) is counted and ended there and then, and so is one
+  that can never be taken back up: its client was never told the token (a
+  v1 game), or it was already waiting the last time the journal was read
+  back, and nobody took it up while that server ran. Otherwise those would
+  wait in every journal from then on.
+*/
+
+#define JOURNAL_MAGIC "WRDLJNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 4096 // bytes before the first record
+// The position of a record has to fit in a token's low 32 bits.
+#define JOURNAL_MAX_RECORDS UINT32_MAX
+#define JOURNAL_GROW 65536               // records the file grows by, 1MB
+#define JOURNAL_SYNC_NS 10000000         // 10ms
+#define JOURNAL_GUESSES 6                // the most guesses a game has
+#define JOURNAL_NO_TOKEN UINT64_MAX
+
+enum journal_type { JOURNAL_EMPTY, JOURNAL_START, JOURNAL_GUESS, JOURNAL_END };
+
+struct JournalRecord {
+    atomic_uchar type;    // stored last
+    // What a guess scored, 1 if an ended game was won, or 1 if a started
+    // one's client was never told its token.
+    uint8_t pattern;
+    uint8_t pattern_high; // the pattern's top 8 bits
+    uint8_t word_high;    // the word's top 8 bits
+    uint32_t word;        // packed: the word a game is against, or the guess
+    uint64_t token;       // the game
+};
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    atomic_ullong next; // the next record to claim
+    // How long the words are, or 0 in a journal from before it was kept,
+    // which is of 5 letter words.
+    uint32_t word_len;
+    // Where the records stopped the last time the journal was read back
+    // (0 if it never has been).
+    uint64_t recovered_at;
+};
+
+struct Journal {
+    int fd;
+    struct JournalHeader *header;
+    struct JournalRecord *records; // JOURNAL_MAX_RECORDS of address space
+    atomic_ullong room;            // records the file has room for
+    pthread_mutex_t grow_mutex;
+    pthread_t syncer;
+    bool syncing;
+    atomic_bool stopping;
+    uint64_t synced; // records written out to the disk
+};
+
+// A game the journal has no end for.
+struct JournalGame {
+    uint64_t token; // JOURNAL_NO_TOKEN for an empty slot
+    word_key target;
+    int guesses;
+    word_key played[JOURNAL_GUESSES];
+    pattern_code patterns[JOURNAL_GUESSES];
+    bool resumable;    // by a client, while this server runs
+    atomic_bool taken; // by a client that resumed it, or ended
+};
+
+// What was in the journal when the server started.
+struct JournalRecovery {
+    long guesses;
+    long wins;
+    long losses;
+    long games;
+    // The unfinished games, open addressed on their token.
+    struct JournalGame *open;
+    uint32_t mask;
+    int num_open;
+};
+
+static inline size_t journalMapSize() {
+    return JOURNAL_HEADER_SIZE +
+           (size_t)JOURNAL_MAX_RECORDS * sizeof(struct JournalRecord);
+}
+
+// Opens the journal in fn, making a new one if there is none.
+// Returns false on error.
+static inline bool openJournal(struct Journal *j, const char *fn) {
+    struct stat st;
+    j->fd = open(fn, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (j->fd == -1) {
+        perror("ERROR: open() of the journal failed");
+        return false;
+    }
+    if (fstat(j->fd, &st) == -1) {
+        perror("ERROR: fstat() of the journal failed");
+        close(j->fd);
+        return false;
+    }
+    bool fresh = st.st_size == 0;
+    if (fresh) {
+        int rc = posix_fallocate(j->fd, 0, JOURNAL_HEADER_SIZE);
+        if (rc != 0) {
+            fprintf(stderr, "ERROR: posix_fallocate() failed: %s\n",
+                    strerror(rc));
+            close(j->fd);
+            return false;
+        }
+        st.st_size = JOURNAL_HEADER_SIZE;
+    } else if (st.st_size < JOURNAL_HEADER_SIZE) {
+        fprintf(stderr, "ERROR: %s is not a journal\n", fn);
+        close(j->fd);
+        return false;
+    }
+
+    // Only the part of the file that is there can be touched, the rest of
+    // the address space is filled in as it grows.
+    char *map = mmap(NULL, journalMapSize(), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_NORESERVE, j->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("ERROR: mmap() of the journal failed");
+        close(j->fd);
+        return false;
+    }
+    j->header = (struct JournalHeader *)map;
+    j->records = (struct JournalRecord *)(map + JOURNAL_HEADER_SIZE);
+    if (fresh) {
+        j->header->version = JOURNAL_VERSION;
+        j->header->record_size = sizeof(struct JournalRecord);
+        j->header->word_len = WORD_LEN;
+        atomic_store(&j->header->next, 0);
+        memcpy(j->header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    } else if (memcmp(j->header->magic, JOURNAL_MAGIC,
+                      sizeof(JOURNAL_MAGIC)) != 0 ||
+               j->header->version != JOURNAL_VERSION ||
+               j->header->record_size != sizeof(struct JournalRecord)) {
+        fprintf(stderr, "ERROR: %s is not a journal\n", fn);
+        munmap(map, journalMapSize());
+        close(j->fd);
+        return false;
+    } else if (j->header->word_len != WORD_LEN &&
+               (j->header->word_len != 0 || WORD_LEN != 5)) {
+        fprintf(stderr, "ERROR: %s is a journal of %u letter words\n", fn,
+                j->header->word_len != 0 ? j->header->word_len : 5);
+        munmap(map, journalMapSize());
+        close(j->fd);
+        return false;
+    }
+    atomic_init(&j->room, (st.st_size - JOURNAL_HEADER_SIZE) /
+                              sizeof(struct JournalRecord));
+    pthread_mutex_init(&j->grow_mutex, NULL);
+    j->syncing = false;
+    j->synced = atomic_load(&j->header->next);
+    return true;
+}
+
+// Grows the file so it has room for record pos. Another server appending to
+// the same journal may grow it too, which posix_fallocate() never undoes.
+// Returns false on error.
+static inline bool growJournal(struct Journal *j, uint64_t pos) {
+    bool ok = true;
+    pthread_mutex_lock(&j->grow_mutex);
+    uint64_t room = atomic_load(&j->room);
+    if (pos >= room) {
+        room = (pos / JOURNAL_GROW + 1) * JOURNAL_GROW;
+        if (room > JOURNAL_MAX_RECORDS)
+            room = JOURNAL_MAX_RECORDS;
+        int rc = posix_fallocate(j->fd, 0,
+                                 JOURNAL_HEADER_SIZE +
+                                     room * sizeof(struct JournalRecord));
+        if (rc != 0) {
+            fprintf(stderr, "ERROR: posix_fallocate() failed: %s\n",
+                    strerror(rc));
+            ok = false;
+        } else {
+            atomic_store(&j->room, room);
+        }
+    }
+    pthread_mutex_unlock(&j->grow_mutex);
+    return ok;
+}
+
+// Claims the next record and fills it in.
+// Returns its position, or JOURNAL_MAX_RECORDS if the journal is full or
+// could not grow.
+static inline uint64_t appendJournal(struct Journal *j, enum journal_type type,
+                                     pattern_code pattern, word_key word,
+                                     uint64_t token, uint32_t check) {
+    uint64_t pos =
+        atomic_fetch_add_explicit(&j->header->next, 1, memory_order_relaxed);
+    if (pos >= JOURNAL_MAX_RECORDS) {
+        fprintf(stderr, "ERROR: the journal is full\n");
+        return JOURNAL_MAX_RECORDS;
+    }
+    if (pos >= atomic_load_explicit(&j->room, memory_order_relaxed) &&
+        !growJournal(j, pos))
+        return JOURNAL_MAX_RECORDS;
+
+    struct JournalRecord *r = j->records + pos;
+    r->pattern = pattern;
+    r->pattern_high = pattern >> 8;
+    r->word = word;
+    r->word_high = (uint64_t)word >> 32;
+    r->token = type == JOURNAL_START ? (uint64_t)check << 32 | pos : token;
+    atomic_store_explicit(&r->type, type, memory_order_release);
+    return pos;
+}
+
+static inline word_key recordWord(const struct JournalRecord *r) {
+    return (word_key)((uint64_t)r->word_high << 32 | r->word);
+}
+
+static inline pattern_code recordPattern(const struct JournalRecord *r) {
+    return r->pattern | r->pattern_high << 8;
+}
+
+// Records a game against the packed word target starting. check is the
+// random part of its token, and resumable is false if the client will never
+// be told the token.
+// Returns the game's token, or JOURNAL_NO_TOKEN on error.
+static inline uint64_t journalStart(struct Journal *j, word_key target,
+                                    uint32_t check, bool resumable) {
+    uint64_t pos =
+        appendJournal(j, JOURNAL_START, !resumable, target, 0, check);
+    if (pos == JOURNAL_MAX_RECORDS)
+        return JOURNAL_NO_TOKEN;
+    return (uint64_t)check << 32 | pos;
+}
+
+// Records a valid guess (packed) and the pattern it got.
+// Returns false on error.
+static inline bool journalGuess(struct Journal *j, uint64_t token,
+                                word_key guess, pattern_code pattern) {
+    return appendJournal(j, JOURNAL_GUESS, pattern, guess, token, 0) !=
+           JOURNAL_MAX_RECORDS;
+}
+
+// Records a game ending.
+// Returns false on error.
+static inline bool journalEnd(struct Journal *j, uint64_t token, bool won) {
+    return appendJournal(j, JOURNAL_END, won, 0, token, 0) !=
+           JOURNAL_MAX_RECORDS;
+}
+
+// Writes every record appended since the last call out to the disk.
+static inline void syncJournal(struct Journal *j) {
+    uint64_t next = atomic_load(&j->header->next);
+    uint64_t room = atomic_load(&j->room);
+    if (next > room)
+        next = room;
+    if (next <= j->synced)
+        return;
+
+    // msync() wants a page aligned start. The header goes out after the
+    // records it counts.
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)(j->records + j->synced);
+    uintptr_t end = (uintptr_t)(j->records + next);
+    start -= start % page;
+    if (msync((void *)start, end - start, MS_SYNC) == -1 ||
+        msync(j->header, JOURNAL_HEADER_SIZE, MS_SYNC) == -1)
+        perror("ERROR: msync() of the journal failed");
+    else
+        j->synced = next;
+}
+
+static void *journalSyncer(void *arg) {
+    struct Journal *j = arg;
+    struct timespec ts = {0, JOURNAL_SYNC_NS};
+
+    while (!atomic_load_explicit(&j->stopping, memory_order_acquire)) {
+        nanosleep(&ts, NULL);
+        syncJournal(j);
+    }
+    return NULL;
+}
+
+// Starts the syncer thread.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+static inline int startJournal(struct Journal *j) {
+    atomic_init(&j->stopping, false);
+    if (spawnHelper(&j->syncer, journalSyncer, j) != 0) {
+        perror("ERROR: pthread_create() failed");
+        return EXIT_FAILURE;
+    }
+    j->syncing = true;
+    return EXIT_SUCCESS;
+}
+
+// Stops the syncer, writes out whatever is left and closes the journal.
+// Nothing may be appending while this runs.
+static inline void closeJournal(struct Journal *j) {
+    if (j->syncing) {
+        atomic_store_explicit(&j->stopping, true, memory_order_release);
+        pthread_join(j->syncer, NULL);
+        j->syncing = false;
+    }
+    syncJournal(j);
+    munmap(j->header, journalMapSize());
+    close(j->fd);
+    pthread_mutex_destroy(&j->grow_mutex);
+}
+
+// Returns the start record of the game with that token, or NULL if there
+// is none in the first n records.
+static inline struct JournalRecord *journalGameStart(struct Journal *j,
+                                                     uint64_t token,
+                                                     uint64_t n) {
+    uint32_t pos = (uint32_t)token;
+    if (pos >= n)
+        return NULL;
+    struct JournalRecord *r = j->records + pos;
+    if (atomic_load_explicit(&r->type, memory_order_acquire) !=
+            JOURNAL_START ||
+        r->token != token)
+        return NULL;
+    return r;
+}
+
+// Returns the unfinished game with that token, or NULL.
+static inline struct JournalGame *findJournalGame(struct JournalRecovery *rec,
+                                                  uint64_t token) {
+    if (rec->open == NULL)
+        return NULL;
+    uint32_t i = (uint32_t)(token * 0x9e3779b97f4a7c15 >> 32) & rec->mask;
+    while (rec->open[i].token != JOURNAL_NO_TOKEN) {
+        if (rec->open[i].token == token)
+            return rec->open + i;
+        i = (i + 1) & rec->mask;
+    }
+    return NULL;
+}
+
+// Hands the unfinished game with that token to the client that asked for
+// it, unless somebody else already has it.
+// Returns NULL if there is no such game to take.
+static inline struct JournalGame *takeJournalGame(struct JournalRecovery *rec,
+                                                  uint64_t token) {
+    struct JournalGame *game = findJournalGame(rec, token);
+    bool taken = false;
+    if (game == NULL ||
+        !atomic_compare_exchange_strong(&game->taken, &taken, true))
+        return NULL;
+    return game;
+}
+
+// Gives back a game from takeJournalGame() that could not be resumed.
+static inline void returnJournalGame(struct JournalGame *game) {
+    atomic_store(&game->taken, false);
+}
+
+static inline void freeJournalRecovery(struct JournalRecovery *rec) {
+    free(rec->open);
+    rec->open = NULL;
+}
+
+// Reads the journal back: counts the guesses, wins and losses in it into
+// rec, appends the words its games were played against to log, and keeps
+// the games that have not ended. Games that were over without having been
+// ended are ended now, and so are the ones no client can take back up,
+// which count as lost.
+// Returns false on error.
+static inline bool recoverJournal(struct Journal *j, struct WordLog *log,
+                                  struct JournalRecovery *rec) {
+    uint64_t n = atomic_load(&j->header->next);
+    uint64_t room = atomic_load(&j->room);
+    if (n > room)
+        n = room;
+    uint64_t recovered_at = j->header->recovered_at;
+    memset(rec, 0, sizeof(*rec));
+
+    // One bit per record, set for the start of every game that has not
+    // ended.
+    uint64_t *open = calloc(n / 64 + 1, sizeof(uint64_t));
+    if (open == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return false;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        struct JournalRecord *r = j->records + i;
+        uint32_t start;
+        switch (atomic_load_explicit(&r->type, memory_order_acquire)) {
+        case JOURNAL_START:
+            *(open + i / 64) |= 1ull << i % 64;
+            rec->games++;
+            if (!appendWordLog(log, recordWord(r))) {
+                free(open);
+                return false;
+            }
+            break;
+        case JOURNAL_GUESS:
+            rec->guesses++;
+            break;
+        case JOURNAL_END:
+            if (journalGameStart(j, r->token, n) == NULL)
+                break;
+            start = (uint32_t)r->token;
+            *(open + start / 64) &= ~(1ull << start % 64);
+            if (r->pattern)
+                rec->wins++;
+            else
+                rec->losses++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (uint64_t i = 0; i < n / 64 + 1; i++)
+        rec->num_open += __builtin_popcountll(*(open + i));
+    if (rec->num_open == 0) {
+        free(open);
+        return true;
+    }
+    uint32_t size = 2;
+    while (size < 2 * (uint32_t)rec->num_open)
+        size <<= 1;
+    rec->mask = size - 1;
+    rec->open = malloc(size * sizeof(struct JournalGame));
+    if (rec->open == NULL) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        free(open);
+        return false;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        (rec->open + i)->token = JOURNAL_NO_TOKEN;
+        atomic_init(&(rec->open + i)->taken, false);
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        struct JournalRecord *r = j->records + i;
+        enum journal_type type =
+            atomic_load_explicit(&r->type, memory_order_acquire);
+        uint32_t pos = (uint32_t)r->token;
+        if ((type != JOURNAL_START && type != JOURNAL_GUESS) || pos >= n ||
+            !(*(open + pos / 64) & 1ull << pos % 64))
+            continue;
+
+        if (type == JOURNAL_START) {
+            uint32_t slot =
+                (uint32_t)(r->token * 0x9e3779b97f4a7c15 >> 32) & rec->mask;
+            while ((rec->open + slot)->token != JOURNAL_NO_TOKEN)
+                slot = (slot + 1) & rec->mask;
+            (rec->open + slot)->token = r->token;
+            (rec->open + slot)->target = recordWord(r);
+            (rec->open + slot)->guesses = 0;
+            (rec->open + slot)->resumable = !r->pattern && i >= recovered_at;
+            continue;
+        }
+        struct JournalGame *game = findJournalGame(rec, r->token);
+        if (game != NULL && game->guesses < JOURNAL_GUESSES) {
+            game->played[game->guesses] = recordWord(r);
+            game->patterns[game->guesses++] = recordPattern(r);
+        }
+    }
+    free(open);
+
+    for (uint32_t i = 0; i < size; i++) {
+        struct JournalGame *game = rec->open + i;
+        if (game->token == JOURNAL_NO_TOKEN)
+            continue;
+        bool won = game->guesses > 0 &&
+                   game->played[game->guesses - 1] == game->target;
+        if (!won && game->guesses < JOURNAL_GUESSES && game->resumable)
+            continue;
+        if (won)
+            rec->wins++;
+        else
+            rec->losses++;
+        atomic_store(&game->taken, true);
+        rec->num_open--;
+        if (!journalEnd(j, game->token, won))
+            return false;
+    }
+    j->header->recovered_at = n;
+    return true;
+}
+
+#endif
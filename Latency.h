@@ -0,0 +1,219 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Histogram.h"
+/*
+  How long the server spends in each stage of serving a client, kept as
+  histograms in a shared memory segment (/dev/shm/<name>) that hw3-stat.c
+  reads while the server runs.
+
+  The segment is a header followed by LATENCY_SLOTS slots of histograms, one
+  per stage. Same as the counters in Stats.h, every thread keeps to one slot
+  picked round robin, so with no more threads than slots nobody shares a
+  cache line, and recording a time is a clock read (from the vDSO, not a
+  system call) and one relaxed atomic add. The reader adds up the slots
+  without taking any locks; a count it reads mid update is at most one
+  value behind.
+  The buckets are the same log-linear ones as Histogram.h with fewer bits,
+  about 12% wide, up to 2^40 ns (18 minutes), which keeps a slot at 12KB.
+*/
+
+#define LATENCY_MAGIC "WRDLLAT"
+#define LATENCY_VERSION 1
+#define LATENCY_SLOTS 64
+#define LATENCY_LINE 64
+#define LATENCY_SUB_BITS 4
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS                                                        \
+    ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 2) * (1 << (LATENCY_SUB_BITS - 1)))
+
+enum latency_stage {
+    LAT_ACCEPT,        // accept() returning to the connection being handed off
+    LAT_FIRST_REQUEST, // the connection being accepted to its first request
+    LAT_SERVICE,       // a request arriving to its reply being sent
+    LAT_LOOKUP,        // checking a guess against the dictionary
+    LAT_LOCK_WAIT,     // adding to and removing from the connection registry
+    NUM_LAT_STAGES
+};
+
+static inline const char *latencyStageName(enum latency_stage stage) {
+    static const char *names[NUM_LAT_STAGES] = {
+        "accept", "first req", "service", "lookup", "lock wait"};
+    return names[stage];
+}
+
+struct LatencyHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slots;
+    uint32_t stages;
+    uint32_t buckets;
+    uint32_t sub_bits;
+    int32_t pid;
+    atomic_uint next_slot;
+};
+
+struct LatencySlot {
+    _Alignas(LATENCY_LINE) atomic_ullong counts[NUM_LAT_STAGES]
+                                               [LATENCY_BUCKETS];
+};
+
+struct LatencySegment {
+    _Alignas(LATENCY_LINE) struct LatencyHeader header;
+    struct LatencySlot slots[LATENCY_SLOTS];
+};
+
+#define LATENCY_NAME_SIZE 256
+
+static __thread int latency_slot = -1;
+
+// shm_open() wants names that start with a '/', which the user can leave off.
+static inline const char *latencyShmName(const char *name, char *out) {
+    snprintf(out, LATENCY_NAME_SIZE, "%s%s", *name == '/' ? "" : "/", name);
+    return out;
+}
+
+// Returns the time in nanoseconds, or 0 if seg is NULL (stats are off), so
+// a disabled server does not even read the clock.
+static inline uint64_t latencyClock(const struct LatencySegment *seg) {
+    struct timespec ts;
+    if (seg == NULL)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void recordLatency(struct LatencySegment *seg,
+                                 enum latency_stage stage, uint64_t ns) {
+    if (seg == NULL)
+        return;
+    if (latency_slot < 0)
+        latency_slot = atomic_fetch_add_explicit(&seg->header.next_slot, 1,
+                                                 memory_order_relaxed) %
+                       LATENCY_SLOTS;
+    if (ns >= 1ull << LATENCY_MAX_BITS)
+        ns = (1ull << LATENCY_MAX_BITS) - 1;
+    atomic_fetch_add_explicit(
+        &seg->slots[latency_slot]
+             .counts[stage][histBucketBits(ns, LATENCY_SUB_BITS)],
+        1, memory_order_relaxed);
+}
+
+// Records the time since start, a value from latencyClock().
+static inline void recordSince(struct LatencySegment *seg,
+                               enum latency_stage stage, uint64_t start) {
+    if (seg != NULL)
+        recordLatency(seg, stage, latencyClock(seg) - start);
+}
+
+// Creates the segment /dev/shm/<name>, replacing any that is there. A server
+// that is still using the old one (say, one being upgraded) keeps it until
+// it exits, rather than having it emptied under it.
+// Returns NULL on error.
+static inline struct LatencySegment *openLatency(const char *user_name) {
+    char name[LATENCY_NAME_SIZE];
+    latencyShmName(user_name, name);
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("ERROR: shm_open() failed");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(struct LatencySegment)) == -1) {
+        perror("ERROR: ftruncate() failed");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    struct LatencySegment *seg =
+        mmap(NULL, sizeof(struct LatencySegment), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror("ERROR: mmap() failed");
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // A new segment is all zeros, which is every count empty.
+    seg->header.version = LATENCY_VERSION;
+    seg->header.slots = LATENCY_SLOTS;
+    seg->header.stages = NUM_LAT_STAGES;
+    seg->header.buckets = LATENCY_BUCKETS;
+    seg->header.sub_bits = LATENCY_SUB_BITS;
+    seg->header.pid = getpid();
+    atomic_thread_fence(memory_order_release);
+    memcpy(seg->header.magic, LATENCY_MAGIC, sizeof(LATENCY_MAGIC));
+    return seg;
+}
+
+// Unmaps the segment, and removes it if name is not NULL.
+static inline void closeLatency(struct LatencySegment *seg, const char *name) {
+    char shm_name[LATENCY_NAME_SIZE];
+    munmap(seg, sizeof(struct LatencySegment));
+    if (name != NULL)
+        shm_unlink(latencyShmName(name, shm_name));
+}
+
+// Maps the segment /dev/shm/<name> read only, for a reader.
+// Returns NULL if it does not exist (yet) or was made by a different
+// version of the server.
+static inline const struct LatencySegment *attachLatency(const char *name) {
+    char shm_name[LATENCY_NAME_SIZE];
+    struct stat st;
+    int fd = shm_open(latencyShmName(name, shm_name), O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) == -1 || st.st_size != sizeof(struct LatencySegment)) {
+        close(fd);
+        return NULL;
+    }
+    const struct LatencySegment *seg = mmap(
+        NULL, sizeof(struct LatencySegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+        return NULL;
+    if (memcmp(seg->header.magic, LATENCY_MAGIC, sizeof(LATENCY_MAGIC)) != 0 ||
+        seg->header.version != LATENCY_VERSION ||
+        seg->header.stages != NUM_LAT_STAGES ||
+        seg->header.buckets != LATENCY_BUCKETS) {
+        munmap((void *)seg, sizeof(struct LatencySegment));
+        return NULL;
+    }
+    return seg;
+}
+
+// Adds up every slot's counts for stage into counts (LATENCY_BUCKETS of
+// them).
+static inline void readLatency(const struct LatencySegment *seg,
+                               enum latency_stage stage, uint64_t *counts) {
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        counts[b] = 0;
+        for (int i = 0; i < LATENCY_SLOTS; i++)
+            counts[b] += atomic_load_explicit(
+                (atomic_ullong *)&seg->slots[i].counts[stage][b],
+                memory_order_relaxed);
+    }
+}
+
+// Turns bucket counts from readLatency() into a histogram to print, with
+// every value at the top of its bucket.
+static inline void latencyHist(const uint64_t *counts, struct Histogram *hist) {
+    clearHist(hist);
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+        recordHistCount(hist, histBucketTopBits(b, LATENCY_SUB_BITS),
+                        counts[b]);
+}
+
+#endif
@@ -0,0 +1,441 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Thread.h"
+/*
+  The server's log, which is everything it prints to stdout.
+  A thread that logs does not print anything itself. It writes a 64 byte
+  binary record (the event, its thread, a word and a count) into a ring of
+  its own, and a writer thread turns the records into the same lines the
+  server has always printed and writes them out a batch at a time. Each
+  ring has one thread writing and the writer reading, so adding a record is
+  a clock read, a copy and a release store, with no locks and no system
+  calls, and a slow terminal or pipe only ever holds up the writer.
+
+  Threads claim a ring the first time they log and give it back when they
+  are done with it. If every ring is taken, the rest share the last one
+  under a mutex. The writer merges the rings by the time each record was
+  made, so lines come out in the order they happened, as they would have
+  been printed.
+
+  When a ring is full, the thread either waits for the writer to make room
+  (LOG_BLOCK) or throws the record away and counts it (LOG_DROP). LOG_SYNC,
+  and a logger that has not been started, prints every line straight away
+  in the thread that logs it, as printf() did.
+*/
+
+#define LOG_RINGS 128 // the last one is shared
+#define LOG_RING_SIZE 512 // records, a power of two
+#define LOG_LINE 64
+#define LOG_DATA 40
+#define LOG_TEXT_MAX 256
+#define LOG_LINE_MAX 160
+#define LOG_BATCH 65536
+#define LOG_IDLE_NS 1000000 // how long the writer sleeps when there is nothing
+#define LOG_FULL_NS 100000  // how long a blocked thread waits for room
+
+enum log_level { LOG_OFF, LOG_INFO, LOG_DEBUG };
+
+enum log_policy { LOG_SYNC, LOG_BLOCK, LOG_DROP };
+
+enum log_event {
+    LOG_TEXT,        // a line formatted by logText(), in one or more records
+    LOG_CONNECTION,  // the accept loop took a connection
+    LOG_SHUTDOWN,    // the server was told to stop
+    LOG_PROTOCOL_V2, // the client sent the v2 hello
+    LOG_GAVE_UP,     // the client hung up
+    LOG_QUIT_GAME,   // the client ended v2 game count
+    LOG_RESUME_GAME, // the client took a game back up as v2 game count
+    LOG_GAME_OVER,   // the game against data is over
+    LOG_WAITING,     // a thread started waiting for a guess
+    LOG_GUESS,       // data was guessed
+    LOG_INVALID,     // a non-word got data back, count guesses left
+    LOG_REPLY,       // the guess got data back, count guesses left
+    LOG_HINT,        // the hint engine suggested data, count guesses left
+    LOG_WORDLE,      // a game started against data
+    LOG_SEND_BUFFER, // the bytes of a reply
+    NUM_LOG_EVENTS
+};
+
+// Events from LOG_WAITING on are one or more lines per guess, and only
+// logged at LOG_DEBUG.
+static inline enum log_level logEventLevel(enum log_event event) {
+    return event >= LOG_WAITING ? LOG_DEBUG : LOG_INFO;
+}
+
+struct LogRecord {
+    uint64_t time;        // CLOCK_MONOTONIC nanoseconds
+    unsigned long thread; // pthread_self() of the thread that logged it
+    uint16_t event;
+    uint8_t len;  // bytes of data used
+    uint8_t more; // a LOG_TEXT line goes on in the next record
+    int32_t count;
+    char data[LOG_DATA];
+};
+
+struct LogRing {
+    // Only the writer moves head, and only the owner moves tail.
+    _Alignas(LOG_LINE) atomic_uint head;
+    _Alignas(LOG_LINE) atomic_uint tail;
+    atomic_bool owned;
+    _Alignas(LOG_LINE) struct LogRecord records[LOG_RING_SIZE];
+};
+
+struct Logger {
+    enum log_level level;
+    enum log_policy policy;
+    struct LogRing *rings; // NULL until the writer has started
+    pthread_mutex_t shared; // guards adding to the last ring
+    atomic_uint next_ring;
+    atomic_bool stopping;
+    atomic_ulong dropped;
+    pthread_t writer;
+    int fd;
+    char *batch; // LOG_BATCH bytes of lines for the writer to write out
+};
+
+// The ring this thread logs to, if it has claimed one.
+static __thread struct LogRing *log_ring = NULL;
+
+static inline uint64_t logClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void logSleep(long ns) {
+    struct timespec ts = {0, ns};
+    nanosleep(&ts, NULL);
+}
+
+// Writes the line (or for LOG_TEXT, the part of a line) for r into out,
+// which has room for LOG_LINE_MAX bytes. Returns its length.
+static inline int formatLogRecord(const struct LogRecord *r, char *out) {
+    const char *es = r->count == 1 ? "" : "es";
+    int len;
+
+    switch (r->event) {
+    case LOG_TEXT:
+        memcpy(out, r->data, r->len);
+        return r->len;
+    case LOG_CONNECTION:
+        return sprintf(out, "MAIN: rcvd incoming connection request\n");
+    case LOG_SHUTDOWN:
+        return sprintf(out,
+                       "MAIN: SIGUSR1 rcvd; Wordle server shutting down...\n");
+    case LOG_PROTOCOL_V2:
+        return sprintf(out, "THREAD %lu: client speaks protocol v2\n",
+                       r->thread);
+    case LOG_GAVE_UP:
+        return sprintf(out,
+                       "THREAD %lu: client gave up; closing TCP "
+                       "connection...\n",
+                       r->thread);
+    case LOG_QUIT_GAME:
+        return sprintf(out, "THREAD %lu: client gave up on game %u\n",
+                       r->thread, (uint32_t)r->count);
+    case LOG_RESUME_GAME:
+        return sprintf(out, "THREAD %lu: client resumed game %u\n",
+                       r->thread, (uint32_t)r->count);
+    case LOG_GAME_OVER:
+        return sprintf(out, "THREAD %lu: game over; word was %.*s!\n",
+                       r->thread, r->len, r->data);
+    case LOG_WAITING:
+        return sprintf(out, "THREAD %lu: waiting for guess\n", r->thread);
+    case LOG_GUESS:
+        return sprintf(out, "THREAD %lu: rcvd guess: %.*s\n", r->thread,
+                       r->len, r->data);
+    case LOG_INVALID:
+        return sprintf(out,
+                       "THREAD %lu: invalid guess; sending reply: %.*s (%d "
+                       "guess%s left)\n",
+                       r->thread, r->len, r->data, r->count, es);
+    case LOG_REPLY:
+        return sprintf(out,
+                       "THREAD %lu: sending reply: %.*s (%d guess%s left)\n",
+                       r->thread, r->len, r->data, r->count, es);
+    case LOG_HINT:
+        return sprintf(out,
+                       "THREAD %lu: hint requested; sending reply: %.*s (%d "
+                       "guess%s left)\n",
+                       r->thread, r->len, r->data, r->count, es);
+    case LOG_WORDLE:
+        return sprintf(out, "THREAD %lu: wordle is: %.*s\n", r->thread,
+                       r->len, r->data);
+    case LOG_SEND_BUFFER:
+        len = sprintf(out,
+                      "THREAD %lu: contents of send buffer after validation:",
+                      r->thread);
+        for (int i = 0; i < r->len; i++)
+            len += sprintf(out + len, " %02x |", (uint8_t)*(r->data + i));
+        *(out + len) = '\n';
+        return len + 1;
+    default:
+        return 0;
+    }
+}
+
+// Claims a ring for this thread, or settles for the shared one.
+static inline struct LogRing *claimLogRing(struct Logger *log) {
+    unsigned int first = atomic_fetch_add_explicit(&log->next_ring, 1,
+                                                   memory_order_relaxed);
+    for (int i = 0; i < LOG_RINGS - 1; i++) {
+        struct LogRing *ring = log->rings + (first + i) % (LOG_RINGS - 1);
+        bool free_ring = false;
+        if (!atomic_load_explicit(&ring->owned, memory_order_relaxed) &&
+            atomic_compare_exchange_strong_explicit(&ring->owned, &free_ring,
+                                                    true, memory_order_acquire,
+                                                    memory_order_relaxed))
+            return ring;
+    }
+    return log->rings + LOG_RINGS - 1;
+}
+
+// Gives this thread's ring back, for a thread that is about to exit. What
+// it logged is still written out.
+static inline void releaseLogRing(struct Logger *log) {
+    if (log_ring != NULL && log->rings != NULL &&
+        log_ring != log->rings + LOG_RINGS - 1)
+        atomic_store_explicit(&log_ring->owned, false, memory_order_release);
+    log_ring = NULL;
+}
+
+// Adds the n records in recs to this thread's ring, all or none of them.
+static inline void pushLogRecords(struct Logger *log,
+                                  const struct LogRecord *recs, int n) {
+    if (log_ring == NULL)
+        log_ring = claimLogRing(log);
+    struct LogRing *ring = log_ring;
+    bool shared = ring == log->rings + LOG_RINGS - 1;
+
+    if (shared)
+        pthread_mutex_lock(&log->shared);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail + n - atomic_load_explicit(&ring->head, memory_order_acquire) >
+           LOG_RING_SIZE) {
+        if (log->policy == LOG_DROP ||
+            atomic_load_explicit(&log->stopping, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+            if (shared)
+                pthread_mutex_unlock(&log->shared);
+            return;
+        }
+        logSleep(LOG_FULL_NS);
+    }
+    for (int i = 0; i < n; i++)
+        ring->records[(tail + i) % LOG_RING_SIZE] = recs[i];
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    if (shared)
+        pthread_mutex_unlock(&log->shared);
+}
+
+// Logs event with len bytes of data (at most LOG_DATA) and a count.
+static inline void logBytes(struct Logger *log, enum log_event event,
+                            const char *data, int len, int count) {
+    if (logEventLevel(event) > log->level)
+        return;
+
+    struct LogRecord r;
+    r.thread = pthread_self();
+    r.event = event;
+    r.len = len < LOG_DATA ? len : LOG_DATA;
+    r.more = 0;
+    r.count = count;
+    if (data != NULL)
+        memcpy(r.data, data, r.len);
+
+    if (log->rings == NULL || log->policy == LOG_SYNC) {
+        char line[LOG_LINE_MAX];
+        fwrite(line, 1, formatLogRecord(&r, line), stdout);
+        return;
+    }
+    r.time = logClock();
+    pushLogRecords(log, &r, 1);
+}
+
+// Logs event with a word (or any string, cut to LOG_DATA bytes), which may
+// be NULL, and a count.
+static inline void logEvent(struct Logger *log, enum log_event event,
+                            const char *word, int count) {
+    logBytes(log, event, word, word != NULL ? strlen(word) : 0, count);
+}
+
+// Logs a line printf() style, for the messages the server prints once or
+// twice. It is formatted here, in the thread that logs it.
+__attribute__((format(printf, 2, 3))) static inline void
+logText(struct Logger *log, const char *format, ...) {
+    char text[LOG_TEXT_MAX];
+    struct LogRecord recs[(LOG_TEXT_MAX + LOG_DATA - 1) / LOG_DATA];
+    va_list ap;
+    int len;
+    int n = 0;
+
+    if (logEventLevel(LOG_TEXT) > log->level)
+        return;
+    va_start(ap, format);
+    len = vsnprintf(text, LOG_TEXT_MAX, format, ap);
+    va_end(ap);
+    if (len >= LOG_TEXT_MAX)
+        len = LOG_TEXT_MAX - 1;
+    if (log->rings == NULL || log->policy == LOG_SYNC) {
+        fwrite(text, 1, len, stdout);
+        return;
+    }
+
+    uint64_t now = logClock();
+    for (int at = 0; at < len; at += LOG_DATA, n++) {
+        recs[n].time = now;
+        recs[n].thread = pthread_self();
+        recs[n].count = 0;
+        recs[n].event = LOG_TEXT;
+        recs[n].len = len - at < LOG_DATA ? len - at : LOG_DATA;
+        recs[n].more = at + LOG_DATA < len;
+        memcpy(recs[n].data, text + at, recs[n].len);
+    }
+    pushLogRecords(log, recs, n);
+}
+
+// Writes out all of buf, for the writer. A write that fails loses the
+// batch, there is nowhere left to report it.
+static inline void writeLogBatch(int fd, const char *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n == -1)
+            return;
+        done += n;
+    }
+}
+
+// Writes out everything in the rings as of now, oldest record first.
+// Returns the number of records written.
+static inline int drainLogRings(struct Logger *log, char *batch) {
+    int active[LOG_RINGS];
+    unsigned int head[LOG_RINGS];
+    unsigned int tail[LOG_RINGS];
+    int num_active = 0;
+    int written = 0;
+    size_t len = 0;
+    int stick = -1; // the ring a LOG_TEXT line goes on in
+
+    for (int i = 0; i < LOG_RINGS; i++) {
+        struct LogRing *ring = log->rings + i;
+        head[i] = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        tail[i] = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head[i] != tail[i])
+            active[num_active++] = i;
+    }
+
+    while (num_active > 0) {
+        int pick = 0;
+        if (stick >= 0) {
+            while (active[pick] != stick)
+                pick++;
+        } else {
+            for (int a = 1; a < num_active; a++) {
+                int i = active[a];
+                int p = active[pick];
+                if (log->rings[i].records[head[i] % LOG_RING_SIZE].time <
+                    log->rings[p].records[head[p] % LOG_RING_SIZE].time)
+                    pick = a;
+            }
+        }
+
+        int i = active[pick];
+        const struct LogRecord *r =
+            log->rings[i].records + head[i] % LOG_RING_SIZE;
+        len += formatLogRecord(r, batch + len);
+        stick = r->more ? i : -1;
+        written++;
+        if (++head[i] == tail[i])
+            active[pick] = active[--num_active];
+        atomic_store_explicit(&log->rings[i].head, head[i],
+                              memory_order_release);
+
+        if (len > LOG_BATCH - LOG_LINE_MAX) {
+            writeLogBatch(log->fd, batch, len);
+            len = 0;
+        }
+    }
+    writeLogBatch(log->fd, batch, len);
+    return written;
+}
+
+static void *logWriter(void *arg) {
+    struct Logger *log = arg;
+
+    while (!atomic_load_explicit(&log->stopping, memory_order_acquire)) {
+        if (drainLogRings(log, log->batch) == 0)
+            logSleep(LOG_IDLE_NS);
+    }
+    // Whatever was logged before stopLogger() was called.
+    drainLogRings(log, log->batch);
+    return NULL;
+}
+
+// Starts the writer thread, unless log->policy is LOG_SYNC or nothing is
+// logged at log->level. Everything printed to stdout after this should go
+// through the log, or it may come out of order.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+static inline int startLogger(struct Logger *log) {
+    if (log->policy == LOG_SYNC || log->level == LOG_OFF)
+        return EXIT_SUCCESS;
+
+    log->rings = calloc(LOG_RINGS, sizeof(struct LogRing));
+    log->batch = malloc(LOG_BATCH);
+    if (log->rings == NULL || log->batch == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        free(log->rings);
+        free(log->batch);
+        log->rings = NULL;
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&log->shared, NULL);
+    atomic_init(&log->next_ring, 0);
+    atomic_init(&log->stopping, false);
+    atomic_init(&log->dropped, 0);
+    // What was printed so far goes out before anything the writer writes.
+    fflush(stdout);
+    log->fd = fileno(stdout);
+    if (spawnHelper(&log->writer, logWriter, log) != 0) {
+        perror("ERROR: pthread_create() failed");
+        pthread_mutex_destroy(&log->shared);
+        free(log->rings);
+        free(log->batch);
+        log->rings = NULL;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Writes out everything logged so far and stops the writer. Nothing may be
+// logging while this runs; whatever is logged afterwards is printed
+// straight away.
+static inline void stopLogger(struct Logger *log) {
+    if (log->rings == NULL)
+        return;
+    atomic_store_explicit(&log->stopping, true, memory_order_release);
+    pthread_join(log->writer, NULL);
+
+    unsigned long dropped = atomic_load(&log->dropped);
+    if (dropped > 0)
+        fprintf(stderr, "MAIN: the log was full, %lu line%s dropped\n",
+                dropped, dropped == 1 ? "" : "s");
+    pthread_mutex_destroy(&log->shared);
+    free(log->rings);
+    free(log->batch);
+    log->rings = NULL;
+    log_ring = NULL;
+}
+
+#endif
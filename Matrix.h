@@ -0,0 +1,251 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Dictionary.h"
+#include "Wordle.h"
+/*
+  The feedback for every guess against every target in a dictionary,
+  precomputed. Each pattern code (see Wordle.h) fits in a byte for 5 letter
+  words, so the matrix for n words is n * n bytes, about 33MB for knuth.txt
+  (twice that for longer words), and scoring any pair becomes a single
+  load.
+
+  On disk the matrix is a 64 byte header followed by the codes, one row per
+  guess: row g holds the code of guess g against target 0, 1, ... n - 1, with
+  words numbered in dictionary order. Keeping a guess's row together is what
+  solvers want, since they score one guess against a whole list of targets.
+  The header records the dictionary the matrix was built from, so it is only
+  ever used with that dictionary. The file is meant to be mmap()ed, which
+  lets every process using it share one copy in the page cache.
+*/
+
+#define MATRIX_MAGIC "WRDLMTX"
+#define MATRIX_VERSION 1
+#define MATRIX_BYTE_ORDER 0x01020304 // reads back differently if swapped
+#define MATRIX_HEADER_SIZE 64
+
+struct MatrixHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t word_len;
+    uint32_t size; // words in the dictionary
+    uint64_t dict_hash;
+};
+
+struct Matrix {
+    const pattern_code *codes; // NULL if no matrix is loaded
+    uint32_t size;
+    void *map;
+    size_t map_len;
+};
+
+// FNV-1a over the dictionary's packed words, in order.
+static inline uint64_t hashDict(const struct Dictionary *dict) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int i = 0; i < dict->size; i++) {
+        word_key key = *(dict->words + i);
+        for (size_t b = 0; b < sizeof(word_key); b++, key >>= 8) {
+            hash ^= key & 0xff;
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+// The pattern code for guessing word guess when the answer is word target,
+// both dictionary positions.
+static inline pattern_code lookupPattern(const struct Matrix *matrix,
+                                         uint32_t target, uint32_t guess) {
+    return matrix->codes[(size_t)guess * matrix->size + target];
+}
+
+// The codes of guess against every target, in dictionary order.
+static inline const pattern_code *patternRow(const struct Matrix *matrix,
+                                             uint32_t guess) {
+    return matrix->codes + (size_t)guess * matrix->size;
+}
+
+struct MatrixJob {
+    const struct Dictionary *dict;
+    pattern_code *codes;
+    size_t first; // rows first to last - 1 are this job's
+    size_t last;
+};
+
+static void *buildRows(void *arg) {
+    struct MatrixJob *job = arg;
+    size_t n = job->dict->size;
+    for (size_t g = job->first; g < job->last; g++)
+        scoreGuessBatch(*(job->dict->words + g), job->dict->words, n,
+                        job->codes + g * n);
+    return NULL;
+}
+
+// Fills codes (dict->size squared of them) using that many threads.
+// Returns false if it ran out of memory.
+static inline bool buildMatrix(const struct Dictionary *dict,
+                               pattern_code *codes, int threads) {
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    struct MatrixJob *jobs = calloc(threads, sizeof(struct MatrixJob));
+    if (tids == NULL || jobs == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        free(tids);
+        free(jobs);
+        return false;
+    }
+
+    // Each thread gets one run of rows, so no two threads ever write to
+    // the same page except where their runs meet.
+    size_t n = dict->size;
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        (jobs + i)->dict = dict;
+        (jobs + i)->codes = codes;
+        (jobs + i)->first = n * i / threads;
+        (jobs + i)->last = n * (i + 1) / threads;
+    }
+    for (; started < threads; started++) {
+        if (pthread_create(tids + started, NULL, buildRows, jobs + started) !=
+            0) {
+            perror("ERROR: pthread_create() failed");
+            break;
+        }
+    }
+    // Threads that failed to start leave their rows to this one.
+    for (int i = started; i < threads; i++)
+        buildRows(jobs + i);
+    for (int i = 0; i < started; i++)
+        pthread_join(*(tids + i), NULL);
+
+    free(tids);
+    free(jobs);
+    return true;
+}
+
+// Builds the matrix for dict with that many threads, and writes it to
+// filename. The header goes in last, so a file left behind by a failed
+// build is never mistaken for a good one.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+static inline int writeMatrix(const char *filename,
+                              const struct Dictionary *dict, int threads) {
+    size_t n = dict->size;
+    size_t len = MATRIX_HEADER_SIZE + n * n * sizeof(pattern_code);
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("ERROR: open() failed");
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(fd, len) == -1) {
+        perror("ERROR: ftruncate() failed");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    uint8_t *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("ERROR: mmap() failed");
+        return EXIT_FAILURE;
+    }
+
+    if (!buildMatrix(dict, (pattern_code *)(map + MATRIX_HEADER_SIZE),
+                     threads)) {
+        munmap(map, len);
+        return EXIT_FAILURE;
+    }
+
+    struct MatrixHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MATRIX_MAGIC, sizeof(header.magic));
+    header.version = MATRIX_VERSION;
+    header.byte_order = MATRIX_BYTE_ORDER;
+    header.word_len = WORD_LEN;
+    header.size = n;
+    header.dict_hash = hashDict(dict);
+    memcpy(map, &header, sizeof(header));
+
+    int rc = EXIT_SUCCESS;
+    if (msync(map, len, MS_SYNC) == -1) {
+        perror("ERROR: msync() failed");
+        rc = EXIT_FAILURE;
+    }
+    munmap(map, len);
+    return rc;
+}
+
+// Maps the matrix in filename, which has to have been built from dict.
+// Returns false (with matrix->codes left NULL) if it could not be loaded.
+static inline bool loadMatrix(const char *filename,
+                              const struct Dictionary *dict,
+                              struct Matrix *matrix) {
+    struct MatrixHeader header;
+    struct stat info;
+    size_t n = dict->size;
+
+    memset(matrix, 0, sizeof(struct Matrix));
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror("ERROR: open() failed");
+        return false;
+    }
+    if (fstat(fd, &info) == -1) {
+        perror("ERROR: fstat() failed");
+        close(fd);
+        return false;
+    }
+    if ((size_t)info.st_size !=
+        MATRIX_HEADER_SIZE + n * n * sizeof(pattern_code)) {
+        fprintf(stderr, "ERROR: %s is not a matrix for this dictionary\n",
+                filename);
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("ERROR: mmap() failed");
+        return false;
+    }
+
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, MATRIX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.byte_order != MATRIX_BYTE_ORDER) {
+        fprintf(stderr, "ERROR: %s is not a matrix file\n", filename);
+    } else if (header.version != MATRIX_VERSION) {
+        fprintf(stderr, "ERROR: %s is version %u, expected %d\n", filename,
+                header.version, MATRIX_VERSION);
+    } else if (header.word_len != WORD_LEN || header.size != n ||
+               header.dict_hash != hashDict(dict)) {
+        fprintf(stderr, "ERROR: %s is not a matrix for this dictionary\n",
+                filename);
+    } else {
+        matrix->codes =
+            (const pattern_code *)((const char *)map + MATRIX_HEADER_SIZE);
+        matrix->size = n;
+        matrix->map = map;
+        matrix->map_len = info.st_size;
+        return true;
+    }
+    munmap(map, info.st_size);
+    return false;
+}
+
+static inline void unloadMatrix(struct Matrix *matrix) {
+    if (matrix->map != NULL)
+        munmap(matrix->map, matrix->map_len);
+    memset(matrix, 0, sizeof(struct Matrix));
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Dictionary.h"
+/*
+  Version 2 of the wordle protocol, which runs any number of games over one
+  connection.
+
+  A v1 client just starts sending WORD_LEN byte guesses (see Dictionary.h),
+  5 unless the server was built for another length. A v2 client opens with
+  the 5 byte hello below instead, which starts with a byte no v1 guess
+  does, and the server answers with the same 5 bytes. From then on both
+  sides send frames:
+
+    length   2 bytes, network order: the bytes after this field
+    type     1 byte
+    game     4 bytes, network order: which game the frame is about
+    payload  length - 5 bytes
+
+  Games are named by the client. It sends V2_START to open one, then
+  V2_GUESS frames with a WORD_LEN byte guess as the payload, V2_HINT for a
+  hint (if the server has them turned on) or V2_QUIT to give up on it.
+  Requests for different games can be sent back to back without waiting for
+  replies, and are answered in the order they were sent.
+  Guesses and hints are answered with a V2_VALID, V2_INVALID or V2_SUGGEST
+  frame whose payload is the same as the rest of the v1 reply: the guesses
+  left as a network order short and WORD_LEN characters. A game is over,
+  and its name free to use again, once a guess is all green or no guesses
+  are left.
+  V2_START is answered with V2_STARTED and the guesses left, V2_QUIT with
+  V2_ENDED, and anything that cannot be done with V2_ERROR and a 1 byte code.
+  A malformed frame gets a V2_ERR_FRAME error and the server hangs up.
+
+  A server that keeps a journal (see Journal.h) follows the guesses left in
+  V2_STARTED with the game's 8 byte token, in network order. If the server
+  goes away mid game, a client can take the game back up on a new connection
+  with V2_RESUME, the token as the payload and the name it wants the game
+  to have there. That is answered like V2_START, with the guesses the game
+  has left.
+
+  A game can also be played without the server keeping anything about it,
+  so that any server with the same seed and dictionary can take its next
+  guess (see Ticket.h). V2_TICKET starts one and is answered with
+  V2_TICKETED, whose payload is the guesses left and the game's 16 byte
+  ticket. Every guess is then a V2_PLAY frame with the latest ticket and
+  the guess as the payload, answered like V2_GUESS, with the next ticket
+  after the result while the game goes on. The game field of these frames
+  is only echoed back: the connection does not hold the game, so it cannot
+  be quit (the client just stops) or given hints, and a ticket that does not
+  check out gets V2_ERR_TICKET.
+*/
+
+#define V2_HELLO "\0WDL2"
+#define V2_HELLO_SIZE 5
+#define V2_HEADER_SIZE 7
+#define V2_TOKEN_SIZE 8
+#define V2_TICKET_SIZE 16
+// The guesses left as a network order short and WORD_LEN characters.
+#define V2_RESULT_SIZE (2 + WORD_LEN)
+// The largest payload either way is a result with a ticket, just ahead of
+// a V2_PLAY's ticket and guess.
+#define V2_MAX_PAYLOAD (V2_RESULT_SIZE + V2_TICKET_SIZE)
+#define V2_MAX_FRAME (V2_HEADER_SIZE + V2_MAX_PAYLOAD)
+// The guesses left and, with a journal, the token.
+#define V2_STARTED_SIZE (2 + V2_TOKEN_SIZE)
+// The guesses left and the ticket.
+#define V2_TICKETED_SIZE (2 + V2_TICKET_SIZE)
+// The largest frame the server sends, a result with a ticket.
+#define V2_MAX_REPLY (V2_HEADER_SIZE + V2_RESULT_SIZE + V2_TICKET_SIZE)
+
+// Client requests
+#define V2_START 'S'
+#define V2_GUESS 'G'
+#define V2_HINT 'H'
+#define V2_QUIT 'Q'
+#define V2_RESUME 'R'
+#define V2_TICKET 'T'
+#define V2_PLAY 'P'
+
+// Server replies
+#define V2_STARTED 'S'
+#define V2_TICKETED 'T'
+#define V2_VALID 'Y'
+#define V2_INVALID 'N'
+#define V2_SUGGEST 'H'
+#define V2_ENDED 'Q'
+#define V2_ERROR 'E'
+
+enum v2_error {
+    V2_ERR_FRAME = 1,   // the frame could not be parsed
+    V2_ERR_TYPE,        // unknown request type
+    V2_ERR_NO_GAME,     // no game by that name on this connection
+    V2_ERR_GAME_EXISTS, // V2_START for a game that is still going
+    V2_ERR_TOO_MANY,    // the connection has as many games going as allowed
+    V2_ERR_SHUTDOWN,    // the server is shutting down
+    V2_ERR_NO_RESUME,   // no game with that token to take back up
+    V2_ERR_TICKET,      // a ticket this server did not seal, or cannot play
+};
+
+struct Frame {
+    uint8_t type;
+    uint32_t game;
+    const char *payload;
+    int payload_len;
+};
+
+// Reads the frame at the front of buf (len bytes).
+// Returns the size of the whole frame, 0 if it has not all arrived yet, or
+// -1 if it is malformed.
+static inline int parseFrame(const char *buf, int len, struct Frame *frame) {
+    uint16_t length;
+    uint32_t game;
+
+    if (len < 2)
+        return 0;
+    memcpy(&length, buf, sizeof(length));
+    length = ntohs(length);
+    if (length < V2_HEADER_SIZE - 2 || length > V2_MAX_FRAME - 2)
+        return -1;
+    if (len < 2 + length)
+        return 0;
+
+    frame->type = (uint8_t)*(buf + 2);
+    memcpy(&game, buf + 3, sizeof(game));
+    frame->game = ntohl(game);
+    frame->payload = buf + V2_HEADER_SIZE;
+    frame->payload_len = 2 + length - V2_HEADER_SIZE;
+    return 2 + length;
+}
+
+// Writes a frame into out, which needs room for V2_HEADER_SIZE +
+// payload_len bytes.
+// Returns the size of the frame.
+static inline int putFrame(char *out, uint8_t type, uint32_t game,
+                           const void *payload, int payload_len) {
+    uint16_t length = htons(V2_HEADER_SIZE - 2 + payload_len);
+    game = htonl(game);
+    memcpy(out, &length, sizeof(length));
+    *(out + 2) = type;
+    memcpy(out + 3, &game, sizeof(game));
+    if (payload_len > 0)
+        memcpy(out + V2_HEADER_SIZE, payload, payload_len);
+    return V2_HEADER_SIZE + payload_len;
+}
+
+#endif
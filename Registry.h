@@ -0,0 +1,156 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+/*
+  The connections being played by a thread of their own, so the server can
+  tell when they have all finished and wake them up when it shuts down.
+  Slots are handed out from fixed size chunks that never move, and a free
+  slot points to the next free one by index, so adding a connection pops
+  the free list and removing it pushes the slot back: constant time either
+  way, under a mutex that is only held for that long, and nothing is
+  allocated except when every slot in every chunk is taken.
+  A connection is known by an id made of its slot and the slot's
+  generation, which goes up every time the slot is freed. An id that
+  outlives its connection matches nothing, instead of removing whichever
+  connection has the slot now.
+*/
+
+#define REGISTRY_CHUNK 1024 // slots
+#define REGISTRY_MAX_CHUNKS 4096
+#define REGISTRY_NONE UINT32_MAX // the end of the free list
+#define NO_CONN UINT64_MAX
+
+struct RegistrySlot {
+    int csd;
+    bool live;
+    uint32_t generation;
+    uint32_t next_free; // while the slot is free
+};
+
+struct Registry {
+    struct RegistrySlot *chunks[REGISTRY_MAX_CHUNKS];
+    uint32_t num_chunks;
+    uint32_t free_head;
+    int size;
+    pthread_mutex_t mutex;
+};
+
+static inline struct RegistrySlot *registrySlot(struct Registry *reg,
+                                                uint32_t index) {
+    return reg->chunks[index / REGISTRY_CHUNK] + index % REGISTRY_CHUNK;
+}
+
+// Returns a new empty registry, or NULL on error.
+static inline struct Registry *newRegistry() {
+    struct Registry *reg = calloc(1, sizeof(struct Registry));
+    if (reg == NULL)
+        return NULL;
+    reg->free_head = REGISTRY_NONE;
+    pthread_mutex_init(&reg->mutex, NULL);
+    return reg;
+}
+
+// Frees the registry. The connections still in it are left open.
+static inline void freeRegistry(struct Registry *reg) {
+    for (uint32_t i = 0; i < reg->num_chunks; i++)
+        free(reg->chunks[i]);
+    pthread_mutex_destroy(&reg->mutex);
+    free(reg);
+}
+
+// Adds a chunk of free slots. Must hold the registry's mutex.
+// Returns false on error.
+static inline bool growRegistry(struct Registry *reg) {
+    if (reg->num_chunks == REGISTRY_MAX_CHUNKS)
+        return false;
+    struct RegistrySlot *chunk =
+        malloc(REGISTRY_CHUNK * sizeof(struct RegistrySlot));
+    if (chunk == NULL)
+        return false;
+
+    uint32_t first = reg->num_chunks * REGISTRY_CHUNK;
+    for (uint32_t i = 0; i < REGISTRY_CHUNK; i++) {
+        (chunk + i)->live = false;
+        (chunk + i)->generation = 0;
+        (chunk + i)->next_free =
+            i + 1 < REGISTRY_CHUNK ? first + i + 1 : reg->free_head;
+    }
+    reg->chunks[reg->num_chunks++] = chunk;
+    reg->free_head = first;
+    return true;
+}
+
+// Adds the connection on csd.
+// Returns its id, or NO_CONN on error.
+static inline uint64_t addRegistry(struct Registry *reg, int csd) {
+    pthread_mutex_lock(&reg->mutex);
+    if (reg->free_head == REGISTRY_NONE && !growRegistry(reg)) {
+        pthread_mutex_unlock(&reg->mutex);
+        return NO_CONN;
+    }
+    uint32_t index = reg->free_head;
+    struct RegistrySlot *slot = registrySlot(reg, index);
+    reg->free_head = slot->next_free;
+    slot->csd = csd;
+    slot->live = true;
+    reg->size++;
+    uint64_t id = (uint64_t)slot->generation << 32 | index;
+    pthread_mutex_unlock(&reg->mutex);
+    return id;
+}
+
+// Removes the connection with that id and closes its socket.
+// Returns true if it was in the registry, and false otherwise
+static inline bool removeRegistry(struct Registry *reg, uint64_t id) {
+    uint32_t index = id;
+    uint32_t generation = id >> 32;
+
+    pthread_mutex_lock(&reg->mutex);
+    if (id == NO_CONN || index >= reg->num_chunks * REGISTRY_CHUNK) {
+        pthread_mutex_unlock(&reg->mutex);
+        return false;
+    }
+    struct RegistrySlot *slot = registrySlot(reg, index);
+    if (!slot->live || slot->generation != generation) {
+        pthread_mutex_unlock(&reg->mutex);
+        return false;
+    }
+    close(slot->csd);
+    slot->live = false;
+    slot->generation++;
+    slot->next_free = reg->free_head;
+    reg->free_head = index;
+    reg->size--;
+    pthread_mutex_unlock(&reg->mutex);
+    return true;
+}
+
+// Returns how many connections are in the registry.
+static inline int sizeRegistry(struct Registry *reg) {
+    pthread_mutex_lock(&reg->mutex);
+    int size = reg->size;
+    pthread_mutex_unlock(&reg->mutex);
+    return size;
+}
+
+// Calls fn on the socket of every connection in the registry. The mutex is
+// held throughout, so no connection is removed (and its socket closed)
+// while fn is looking at it; fn must not call back into the registry.
+static inline void walkRegistry(struct Registry *reg, void (*fn)(int, void *),
+                                void *arg) {
+    pthread_mutex_lock(&reg->mutex);
+    for (uint32_t c = 0; c < reg->num_chunks; c++) {
+        for (int i = 0; i < REGISTRY_CHUNK; i++) {
+            if (reg->chunks[c][i].live)
+                fn(reg->chunks[c][i].csd, arg);
+        }
+    }
+    pthread_mutex_unlock(&reg->mutex);
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+/*
+  A bounded multi-producer, multi-consumer queue used to hand accepted
+  connections to the worker pool.
+  The ring itself is lock free: every cell carries a sequence number that
+  says whether it is ready to be written or read on the current lap, and
+  producers and consumers claim cells with a compare and swap on their own
+  position counter (Vyukov's bounded queue).
+  Two semaphores count the free and filled cells, so a full queue blocks the
+  producer (the accept loop stops accepting until a worker frees up) and an
+  empty queue puts consumers to sleep instead of spinning. A semaphore that
+  does not need to sleep costs a single atomic operation.
+*/
+
+// Keeps the producer and consumer positions on their own cache lines.
+#define RING_PAD 64
+
+// An accepted connection, where it came in the order of connections, and
+// when it was accepted (see Latency.h).
+struct Client {
+    int sd;
+    uint64_t seq;
+    uint64_t accepted_at;
+};
+
+struct RingCell {
+    atomic_size_t seq;
+    struct Client value;
+};
+
+struct RingQueue {
+    struct RingCell *cells;
+    size_t mask;
+    sem_t slots; // cells free to push into
+    sem_t items; // cells ready to pop from
+    atomic_bool closed;
+    _Alignas(RING_PAD) atomic_size_t head; // next cell to pop
+    _Alignas(RING_PAD) atomic_size_t tail; // next cell to push
+};
+
+// Creates a queue holding at least capacity connections (rounded up to a
+// power of two). Returns NULL if the allocation failed.
+static inline struct RingQueue *newRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    struct RingQueue *q = aligned_alloc(RING_PAD, sizeof(struct RingQueue));
+    if (q == NULL)
+        return NULL;
+    q->cells = calloc(size, sizeof(struct RingCell));
+    if (q->cells == NULL) {
+        free(q);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&q->cells[i].seq, i);
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, false);
+    sem_init(&q->slots, 0, size);
+    sem_init(&q->items, 0, 0);
+    return q;
+}
+
+static inline void freeRing(struct RingQueue *q) {
+    sem_destroy(&q->slots);
+    sem_destroy(&q->items);
+    free(q->cells);
+    free(q);
+}
+
+// Claims the next cell and stores value in it.
+// Returns false if the queue is full.
+static inline bool tryPushRing(struct RingQueue *q, struct Client value) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        struct RingCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->tail, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed)) {
+                cell->value = value;
+                atomic_store_explicit(&cell->seq, pos + 1,
+                                      memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+// Takes the oldest value off the queue.
+// Returns false if the queue is empty.
+static inline bool tryPopRing(struct RingQueue *q, struct Client *value) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        struct RingCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->head, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed)) {
+                *value = cell->value;
+                atomic_store_explicit(&cell->seq, pos + q->mask + 1,
+                                      memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Pushes value, sleeping while the queue is full.
+// Returns false if the wait was interrupted by a signal, or the queue has
+// been closed.
+static inline bool pushRing(struct RingQueue *q, struct Client value) {
+    if (sem_wait(&q->slots) == -1)
+        return false;
+    // closeRing() wakes one sleeping producer, and each one wakes the next.
+    if (atomic_load(&q->closed)) {
+        sem_post(&q->slots);
+        return false;
+    }
+    // The semaphore guarantees a free cell, but the consumer that freed it
+    // may not have finished with it yet if another consumer got ahead of it.
+    while (!tryPushRing(q, value))
+        sched_yield();
+    sem_post(&q->items);
+    return true;
+}
+
+// Pops a value, sleeping while the queue is empty.
+// Returns false once the queue has been closed and there is nothing to pop.
+static inline bool popRing(struct RingQueue *q, struct Client *value) {
+    while (sem_wait(&q->items) == -1)
+        ;
+    // Same as in pushRing(), the producer of this item may still be
+    // filling its cell in.
+    while (!tryPopRing(q, value)) {
+        if (atomic_load(&q->closed))
+            return false;
+        sched_yield();
+    }
+    sem_post(&q->slots);
+    return true;
+}
+
+// Wakes that many sleeping consumers, and makes popRing() return false from
+// now on whenever the queue is empty. Producers waiting for room give up.
+static inline void closeRing(struct RingQueue *q, int consumers) {
+    atomic_store(&q->closed, true);
+    for (int i = 0; i < consumers; i++)
+        sem_post(&q->items);
+    sem_post(&q->slots);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+/*
+  A small pseudo-random number generator (xoshiro256**) that keeps its state
+  in a struct instead of behind rand(), so any number of threads can draw
+  numbers at the same time without sharing anything.
+  Every stream is seeded from a seed and a stream number, so the numbers a
+  stream produces only depend on those two values. The server uses one
+  stream per connection, numbered in the order connections are accepted,
+  which makes the word each game gets the same from run to run no matter
+  how many threads are playing or how they get scheduled.
+*/
+
+struct Rng {
+    uint64_t s[4];
+};
+
+// One step of splitmix64, used to spread a seed over the whole state.
+static inline uint64_t splitMix(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+// Starts stream number stream of seed.
+static inline void seedRng(struct Rng *rng, uint64_t seed, uint64_t stream) {
+    // Mixing the stream number first keeps nearby streams of nearby seeds
+    // from starting out on overlapping splitmix sequences.
+    uint64_t x = stream;
+    x = seed ^ splitMix(&x);
+    for (int i = 0; i < 4; i++)
+        rng->s[i] = splitMix(&x);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t nextRng(struct Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// Returns a number from 0 to range - 1, every one equally likely (unlike
+// taking the remainder). Lemire's method: scale a 32 bit draw up by range
+// and keep the high half, redrawing the few values that would make the low
+// end come up more often. range must not be 0.
+static inline uint32_t boundedRng(struct Rng *rng, uint32_t range) {
+    uint64_t m = (uint64_t)(uint32_t)(nextRng(rng) >> 32) * range;
+    uint32_t low = (uint32_t)m;
+    if (low < range) {
+        uint32_t threshold = -range % range;
+        while (low < threshold) {
+            m = (uint64_t)(uint32_t)(nextRng(rng) >> 32) * range;
+            low = (uint32_t)m;
+        }
+    }
+    return m >> 32;
+}
+
+#endif
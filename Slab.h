@@ -0,0 +1,95 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+/*
+  Fixed size objects handed out from a few big chunks instead of a malloc()
+  each. The first chunk is mapped when the slab is made, sized for as many
+  objects as it is told to expect, and objects are carved off its front as
+  they are needed, so the pages past the ones handed out so far are never
+  touched and take no memory. A freed object goes on a free list, threaded
+  through the objects themselves, and is handed out again before anything
+  new is carved off. Once a chunk is used up another one twice its size is
+  mapped, so running past the expected count costs a system call now and
+  then, not a refused connection.
+  Nothing here locks: whoever shares a slab guards it.
+*/
+
+#define SLAB_MAX_CHUNKS 32
+#define SLAB_ALIGN 16 // the same as malloc()
+
+struct Slab {
+    size_t size;        // of an object, rounded up to SLAB_ALIGN
+    size_t first_chunk; // objects in the first chunk
+    char *chunks[SLAB_MAX_CHUNKS];
+    uint32_t num_chunks;
+    size_t carved; // objects handed out of the last chunk so far
+    void *free_list;
+    size_t used; // objects handed out and not freed
+};
+
+// Returns how many objects chunk i holds.
+static inline size_t slabChunkObjects(const struct Slab *slab, uint32_t i) {
+    return slab->first_chunk << i;
+}
+
+// Maps another chunk to carve objects from.
+// Returns false on error.
+static inline bool growSlab(struct Slab *slab) {
+    if (slab->num_chunks == SLAB_MAX_CHUNKS)
+        return false;
+    char *chunk = mmap(NULL,
+                       slab->size * slabChunkObjects(slab, slab->num_chunks),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (chunk == MAP_FAILED)
+        return false;
+    slab->chunks[slab->num_chunks++] = chunk;
+    slab->carved = 0;
+    return true;
+}
+
+// Maps the first chunk, with room for count objects of size bytes.
+// Returns false on error.
+static inline bool initSlab(struct Slab *slab, size_t size, size_t count) {
+    memset(slab, 0, sizeof(struct Slab));
+    slab->size = (size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+    slab->first_chunk = count > 0 ? count : 1;
+    return growSlab(slab);
+}
+
+// Unmaps every chunk, along with any objects still handed out.
+static inline void destroySlab(struct Slab *slab) {
+    for (uint32_t i = 0; i < slab->num_chunks; i++)
+        munmap(slab->chunks[i], slab->size * slabChunkObjects(slab, i));
+    memset(slab, 0, sizeof(struct Slab));
+}
+
+// Returns a zeroed object, or NULL if there is no memory for one.
+static inline void *allocSlab(struct Slab *slab) {
+    void *obj = slab->free_list;
+    if (obj != NULL) {
+        memcpy(&slab->free_list, obj, sizeof(void *));
+        memset(obj, 0, slab->size);
+    } else {
+        if (slab->carved == slabChunkObjects(slab, slab->num_chunks - 1) &&
+            !growSlab(slab))
+            return NULL;
+        // Fresh pages from mmap() are already zero.
+        obj = slab->chunks[slab->num_chunks - 1] + slab->size * slab->carved++;
+    }
+    slab->used++;
+    return obj;
+}
+
+static inline void freeSlab(struct Slab *slab, void *obj) {
+    memcpy(obj, &slab->free_list, sizeof(void *));
+    slab->free_list = obj;
+    slab->used--;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+/*
+  Server wide counters that every game thread bumps.
+  Each counter is split over STATS_SLOTS cache-line sized slots, and a
+  thread always adds to the same slot, picked round robin the first time it
+  counts anything. With no more threads than slots nobody ever shares a
+  cache line, so counting is one uncontended atomic add. Reading adds up
+  every slot, which is exact once the threads that count have stopped (or
+  a close enough snapshot while they are still running).
+*/
+
+// Enough for one slot per core on anything we run on. More threads than
+// this just share slots, which is still correct, only slower.
+#define STATS_SLOTS 64
+#define STATS_LINE 64
+
+enum stat_id { STAT_GUESSES, STAT_WINS, STAT_LOSSES, NUM_STATS };
+
+struct StatSlot {
+    _Alignas(STATS_LINE) atomic_long count[NUM_STATS];
+};
+
+struct Stats {
+    struct StatSlot slots[STATS_SLOTS];
+    atomic_uint next_slot;
+};
+
+// Every thread keeps to the slot it was given. Initialised lazily so threads
+// that never count anything do not use one up.
+static __thread int stats_slot = -1;
+
+static inline struct StatSlot *myStatSlot(struct Stats *stats) {
+    if (stats_slot < 0)
+        stats_slot = atomic_fetch_add_explicit(&stats->next_slot, 1,
+                                               memory_order_relaxed) %
+                     STATS_SLOTS;
+    return &stats->slots[stats_slot];
+}
+
+static inline void countStat(struct Stats *stats, enum stat_id which) {
+    // Relaxed is enough, readers only need the total to be exact after
+    // joining (or otherwise synchronising with) the threads that count.
+    atomic_fetch_add_explicit(&myStatSlot(stats)->count[which], 1,
+                              memory_order_relaxed);
+}
+
+// Adds n at once, for counts carried over from somewhere else.
+static inline void addStat(struct Stats *stats, enum stat_id which, long n) {
+    atomic_fetch_add_explicit(&myStatSlot(stats)->count[which], n,
+                              memory_order_relaxed);
+}
+
+static inline long readStat(struct Stats *stats, enum stat_id which) {
+    long total = 0;
+    for (int i = 0; i < STATS_SLOTS; i++)
+        total += atomic_load_explicit(&stats->slots[i].count[which],
+                                      memory_order_relaxed);
+    return total;
+}
+
+#endif
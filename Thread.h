@@ -0,0 +1,29 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <pthread.h>
+#include <signal.h>
+/*
+  Starting the server's helper threads: the hint engine's, the log writer,
+  the journal syncer, and the server's own workers, reactors, acceptors and
+  the rest. SIGUSR1 has to interrupt whatever the main thread is waiting
+  in, which only a signal delivered to that thread does, so the helpers
+  leave it to the main thread. It is blocked before a helper is created
+  rather than by the helper itself, or the signal could land on the helper
+  before it got round to that.
+*/
+
+// Starts a thread running start(arg) into *tid, with SIGUSR1 blocked.
+// Returns 0, or the error from pthread_create().
+static inline int spawnHelper(pthread_t *tid, void *(*start)(void *),
+                              void *arg) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    int rc = pthread_create(tid, NULL, start, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+#endif
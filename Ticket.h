@@ -0,0 +1,208 @@
+#ifndef TICKET_H
+#define TICKET_H
+
+#include <endian.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "Dictionary.h"
+#include "Rng.h"
+/*
+  Tickets for stateless games, which the server keeps nothing about between
+  guesses. The game travels with the client instead: it sends the ticket
+  back with every guess, and gets the next one with the reply. A ticket is
+  16 bytes, both halves in network order:
+
+    state  the target's position in the dictionary (30 bits), the guesses
+           left (4 bits), the dictionary's fingerprint (14 bits) and a nonce
+           (16 bits) that tells apart games that happen to have the same
+           word, encrypted
+    tag    SipHash-2-4 of the state before it was encrypted
+
+  The state is encrypted the way SIV does it: XORed with SipHash-2-4 of the
+  tag, under a second key. Any change to the state changes the tag, so two
+  tickets only share a keystream if they are the same ticket, and the word
+  cannot be read off one. Opening a ticket decrypts the state with the tag
+  it came with and checks that the tag matches what comes out, so a client
+  that changes a ticket or makes one up is still caught. Sealing or opening
+  a ticket is two SipHashes of one block, tens of nanoseconds.
+
+  The keys are drawn from getrandom(), or read from a key file for servers
+  that are to take each other's tickets; a server taking over on SIGUSR2 is
+  handed the old one's. Nothing about them comes from the seed.
+  The fingerprint is of every word in dictionary order, so a ticket sealed
+  before a reload that changed the words is turned away, rather than played
+  against whatever word its position holds now.
+
+  Since nothing is kept, nothing stops a client sending the same ticket
+  twice: it can take a guess back, but it cannot get more guesses than a
+  game starts with or change its word. It could run the totals up that way,
+  though, so a stateless game's word is counted when it starts and nothing
+  else about it is.
+*/
+
+#define TICKET_SIZE 16
+// Raw bytes in a key file, the tag's key and then the keystream's.
+#define TICKET_KEY_SIZE 32
+#define TICKET_TARGET_BITS 30
+#define TICKET_GUESS_BITS 4
+#define TICKET_DICT_BITS 14
+#define TICKET_NONCE_BITS 16
+
+_Static_assert(TICKET_TARGET_BITS + TICKET_GUESS_BITS + TICKET_DICT_BITS +
+                       TICKET_NONCE_BITS ==
+                   64,
+               "a ticket's state is 64 bits");
+_Static_assert(DICT_MAX_WORDS <= 1 << TICKET_TARGET_BITS,
+               "a ticket has no room for the last words");
+
+struct TicketKey {
+    uint64_t k0; // the tag's
+    uint64_t k1;
+    uint64_t e0; // the keystream's
+    uint64_t e1;
+};
+
+struct Ticket {
+    uint32_t target;
+    uint8_t guesses; // left
+    uint16_t dict;   // fingerprint, TICKET_DICT_BITS of it
+    uint16_t nonce;
+};
+
+static inline void setTicketKey(struct TicketKey *key, const uint64_t *raw) {
+    key->k0 = le64toh(*raw);
+    key->k1 = le64toh(*(raw + 1));
+    key->e0 = le64toh(*(raw + 2));
+    key->e1 = le64toh(*(raw + 3));
+}
+
+// Draws a new key from getrandom().
+// Returns false on error.
+static inline bool randomTicketKey(struct TicketKey *key) {
+    uint64_t raw[TICKET_KEY_SIZE / sizeof(uint64_t)];
+    if (getrandom(raw, TICKET_KEY_SIZE, 0) != TICKET_KEY_SIZE) {
+        perror("ERROR: getrandom() failed");
+        return false;
+    }
+    setTicketKey(key, raw);
+    return true;
+}
+
+// Reads the key from the first TICKET_KEY_SIZE bytes of the file fn, which
+// head -c 32 /dev/urandom makes.
+// Returns false on error.
+static inline bool readTicketKey(const char *fn, struct TicketKey *key) {
+    uint64_t raw[TICKET_KEY_SIZE / sizeof(uint64_t)];
+    FILE *in = fopen(fn, "rb");
+    if (in == NULL) {
+        perror("ERROR: open() failed");
+        return false;
+    }
+    size_t n = fread(raw, 1, TICKET_KEY_SIZE, in);
+    fclose(in);
+    if (n != TICKET_KEY_SIZE) {
+        fprintf(stderr, "ERROR: %s is shorter than a ticket key (%d bytes)\n",
+                fn, TICKET_KEY_SIZE);
+        return false;
+    }
+    setTicketKey(key, raw);
+    return true;
+}
+
+#define SIP_ROUND(v0, v1, v2, v3)                                              \
+    do {                                                                       \
+        v0 += v1;                                                              \
+        v1 = rotl(v1, 13);                                                     \
+        v1 ^= v0;                                                              \
+        v0 = rotl(v0, 32);                                                     \
+        v2 += v3;                                                              \
+        v3 = rotl(v3, 16);                                                     \
+        v3 ^= v2;                                                              \
+        v0 += v3;                                                              \
+        v3 = rotl(v3, 21);                                                     \
+        v3 ^= v0;                                                              \
+        v2 += v1;                                                              \
+        v1 = rotl(v1, 17);                                                     \
+        v1 ^= v2;                                                              \
+        v2 = rotl(v2, 32);                                                     \
+    } while (0)
+
+// SipHash-2-4, under the key k0 and k1, of the 8 byte message m, read as a
+// little endian number.
+static inline uint64_t sipHash(uint64_t k0, uint64_t k1, uint64_t m) {
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+    // The message length goes in the top byte of the last block, which is
+    // all there is of it past the one full block.
+    uint64_t last = 8ull << 56;
+
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+    v3 ^= last;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        SIP_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// The fingerprint tickets carry of dict: every word, in order, chained
+// through SipHash under a fixed key.
+static inline uint16_t ticketDict(const struct Dictionary *dict) {
+    uint64_t h = 0;
+    for (int i = 0; i < dict->size; i++)
+        h = sipHash(0, 0, h ^ (uint64_t)*(dict->words + i));
+    return h & ((1u << TICKET_DICT_BITS) - 1);
+}
+
+static inline uint64_t ticketState(const struct Ticket *ticket) {
+    uint64_t state = ticket->target & ((1u << TICKET_TARGET_BITS) - 1);
+    state = state << TICKET_GUESS_BITS |
+            (ticket->guesses & ((1u << TICKET_GUESS_BITS) - 1));
+    state = state << TICKET_DICT_BITS |
+            (ticket->dict & ((1u << TICKET_DICT_BITS) - 1));
+    return state << TICKET_NONCE_BITS | ticket->nonce;
+}
+
+// Writes the ticket, with its tag, into out (TICKET_SIZE bytes).
+static inline void sealTicket(const struct TicketKey *key,
+                              const struct Ticket *ticket, char *out) {
+    uint64_t state = ticketState(ticket);
+    uint64_t tag = sipHash(key->k0, key->k1, state);
+    uint64_t net_state = htobe64(state ^ sipHash(key->e0, key->e1, tag));
+    uint64_t net_tag = htobe64(tag);
+    memcpy(out, &net_state, sizeof(uint64_t));
+    memcpy(out + sizeof(uint64_t), &net_tag, sizeof(uint64_t));
+}
+
+// Reads the ticket in (TICKET_SIZE bytes) into ticket.
+// Returns false if its tag does not match, so it was not sealed with key.
+static inline bool openTicket(const struct TicketKey *key, const char *in,
+                              struct Ticket *ticket) {
+    uint64_t state, tag;
+    memcpy(&state, in, sizeof(uint64_t));
+    memcpy(&tag, in + sizeof(uint64_t), sizeof(uint64_t));
+    tag = be64toh(tag);
+    state = be64toh(state) ^ sipHash(key->e0, key->e1, tag);
+    if (sipHash(key->k0, key->k1, state) != tag)
+        return false;
+    ticket->nonce = state & ((1u << TICKET_NONCE_BITS) - 1);
+    state >>= TICKET_NONCE_BITS;
+    ticket->dict = state & ((1u << TICKET_DICT_BITS) - 1);
+    state >>= TICKET_DICT_BITS;
+    ticket->guesses = state & ((1u << TICKET_GUESS_BITS) - 1);
+    ticket->target = state >> TICKET_GUESS_BITS;
+    return true;
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Dictionary.h"
+#include "Ticket.h"
+/*
+  Handing a running server over to a new binary without dropping anything.
+  The running server starts the new one with a UNIX socket to talk over
+  (as UPGRADE_FD, named with -U) and keeps accepting while the new one
+  loads its dictionary. Once the new server writes UPGRADE_READY, the old
+  one stops accepting and passes it the listening sockets with SCM_RIGHTS,
+  so connections waiting in the backlogs are accepted by the new server
+  instead of being refused, along with how many connections have been
+  accepted so far, which keeps every game on the word it would have had,
+  and the key tickets are sealed with, which keeps stateless games going.
+  The old server then finishes the games it has going and, as it exits,
+  sends its totals and the words it played, for the new server to count
+  as its own.
+*/
+
+#define UPGRADE_FD 3
+#define UPGRADE_MAGIC 0x57444c55u // "WDLU"
+#define UPGRADE_READY 'R'
+#define UPGRADE_MAX_LISTENERS 64
+
+struct UpgradeHandoff {
+    uint32_t magic;
+    int32_t pid; // of the old server
+    uint64_t games_accepted;
+    uint32_t num_listeners;
+    struct TicketKey ticket_key;
+};
+
+struct UpgradeTotals {
+    uint32_t magic;
+    int32_t guesses;
+    int32_t wins;
+    int32_t losses;
+    uint64_t num_words;
+};
+
+// Returns false on error.
+static inline bool writeUpgrade(int fd, const void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = send(fd, (const char *)buf + done, len - done,
+                         MSG_NOSIGNAL);
+        if (n == -1)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Returns false on error, or if the other end hung up first.
+static inline bool readUpgrade(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Starts argv[0] again, with -U UPGRADE_FD in front of the rest of argv
+// (less any -U it was given itself), and the other end of a UNIX socket as
+// UPGRADE_FD. Every other descriptor but stdin, stdout and stderr is
+// closed in the new process.
+// Returns the new process's pid and sets *fd to this end of the socket, or
+// returns -1 on error.
+static inline pid_t spawnUpgrade(char **argv, int *fd) {
+    int argc = 0;
+    while (*(argv + argc) != NULL)
+        argc++;
+    char **args = calloc(argc + 3, sizeof(char *));
+    int sv[2];
+    if (args == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("ERROR: socketpair() failed");
+        free(args);
+        return -1;
+    }
+
+    int n = 0;
+    char fd_arg[] = {'0' + UPGRADE_FD, '\0'};
+    *(args + n++) = *argv;
+    *(args + n++) = "-U";
+    *(args + n++) = fd_arg;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(*(argv + i), "-U") == 0 && i + 1 < argc) {
+            i++;
+            continue;
+        }
+        *(args + n++) = *(argv + i);
+    }
+    long max_fd = sysconf(_SC_OPEN_MAX);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Only async signal safe calls from here on, the parent has threads.
+        if (dup2(sv[1], UPGRADE_FD) == -1)
+            _exit(EXIT_FAILURE);
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, UPGRADE_FD + 1, ~0u, 0) == -1)
+#endif
+            for (long i = UPGRADE_FD + 1; i < max_fd; i++)
+                close(i);
+        execvp(*args, args);
+        _exit(EXIT_FAILURE);
+    }
+    close(sv[1]);
+    free(args);
+    if (pid == -1) {
+        perror("ERROR: fork() failed");
+        close(sv[0]);
+        return -1;
+    }
+    *fd = sv[0];
+    return pid;
+}
+
+// Passes the handoff->num_listeners listeners to the new server, which has
+// said it is ready.
+// Returns false on error.
+static inline bool sendListeners(int fd, const int *listeners,
+                                 const struct UpgradeHandoff *handoff) {
+    char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_LISTENERS)];
+    struct iovec iov = {(void *)handoff, sizeof(struct UpgradeHandoff)};
+    struct msghdr msg = {0};
+    size_t size = sizeof(int) * handoff->num_listeners;
+
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(size);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(size);
+    memcpy(CMSG_DATA(cmsg), listeners, size);
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(struct UpgradeHandoff)) {
+        perror("ERROR: sendmsg() failed");
+        return false;
+    }
+    return true;
+}
+
+// Tells the old server this one is ready, and takes over its listeners,
+// which go in listeners (room for UPGRADE_MAX_LISTENERS).
+// Returns how many there are, or -1 on error.
+static inline int receiveListeners(int fd, struct UpgradeHandoff *handoff,
+                                   int *listeners) {
+    char ready = UPGRADE_READY;
+    char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_LISTENERS)];
+    struct iovec iov = {handoff, sizeof(struct UpgradeHandoff)};
+    struct msghdr msg = {0};
+    int count = 0;
+
+    if (!writeUpgrade(fd, &ready, 1)) {
+        perror("ERROR: write() to the old server failed");
+        return -1;
+    }
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) !=
+            sizeof(struct UpgradeHandoff) ||
+        handoff->magic != UPGRADE_MAGIC) {
+        fprintf(stderr, "ERROR: the old server did not hand over\n");
+        return -1;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(listeners, CMSG_DATA(cmsg), sizeof(int) * count);
+        }
+    }
+    if (count == 0 || (uint32_t)count != handoff->num_listeners) {
+        fprintf(stderr, "ERROR: the old server did not hand over\n");
+        for (int i = 0; i < count; i++)
+            close(*(listeners + i));
+        return -1;
+    }
+    return count;
+}
+
+// Sends the old server's totals and the NULL terminated list of words it
+// played (which may be NULL).
+// Returns false on error.
+static inline bool sendTotals(int fd, int guesses, int wins, int losses,
+                              char **played) {
+    struct UpgradeTotals totals = {UPGRADE_MAGIC, guesses, wins, losses, 0};
+    char buffer[WORD_LEN * 1024];
+    size_t used = 0;
+
+    while (played != NULL && *(played + totals.num_words) != NULL)
+        totals.num_words++;
+    if (!writeUpgrade(fd, &totals, sizeof(totals)))
+        return false;
+    for (uint64_t i = 0; i < totals.num_words; i++) {
+        memcpy(buffer + used, *(played + i), WORD_LEN);
+        used += WORD_LEN;
+        if (used == sizeof(buffer) || i + 1 == totals.num_words) {
+            if (!writeUpgrade(fd, buffer, used))
+                return false;
+            used = 0;
+        }
+    }
+    return true;
+}
+
+// Reads what sendTotals() sent into totals and a new NULL terminated list
+// of words, which is left NULL if anything goes wrong.
+// Returns false on error, or if the old server exited without sending.
+static inline bool receiveTotals(int fd, struct UpgradeTotals *totals,
+                                 char ***played) {
+    if (!readUpgrade(fd, totals, sizeof(struct UpgradeTotals)) ||
+        totals->magic != UPGRADE_MAGIC)
+        return false;
+    *played = calloc(totals->num_words + 1, sizeof(char *));
+    if (*played == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return false;
+    }
+    for (uint64_t i = 0; i < totals->num_words; i++) {
+        char *word = malloc(WORD_LEN + 1);
+        if (word == NULL || !readUpgrade(fd, word, WORD_LEN)) {
+            free(word);
+            for (uint64_t j = 0; j < i; j++)
+                free(*(*played + j));
+            free(*played);
+            *played = NULL;
+            return false;
+        }
+        *(word + WORD_LEN) = '\0';
+        *(*played + i) = word;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef WORDLOG_H
+#define WORDLOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Dictionary.h"
+/*
+  The log of every word a game has been played against, in the order the
+  games started.
+  Entries are packed words (see Dictionary.h), kept in fixed size chunks.
+  Appending claims the next position with a single atomic add and writes
+  straight into its chunk, so games starting at the same time never wait on
+  each other and nothing already in the log ever moves. The thread that
+  first needs a chunk allocates it and installs it in the chunk directory
+  with a compare and swap.
+  The log is only turned into strings once, when the server shuts down.
+
+  If the log has a spill file, every chunk that fills up is written out to
+  it and freed (in order, once all the chunks before it have been), so a
+  server that runs for a long time only keeps the chunks still being
+  filled in memory.
+*/
+
+#define WORDLOG_CHUNK 4096 // entries per chunk, 16KB of 5 letter words
+#define WORDLOG_MAX_CHUNKS (1 << 16)
+
+// Directory entry for a chunk that is now in the spill file.
+#define WORDLOG_SPILLED ((struct WordChunk *)1)
+
+struct WordChunk {
+    atomic_uint filled; // entries written so far
+    word_key words[WORDLOG_CHUNK];
+};
+
+struct WordLog {
+    _Atomic(struct WordChunk *) *chunks;
+    atomic_size_t next; // next position to claim
+
+    FILE *spill; // NULL if the log is kept in memory
+    pthread_mutex_t spill_mutex;
+    size_t spilled; // chunks written to the spill file
+    bool spill_failed;
+};
+
+// Sets up an empty log. If spill_fn is not NULL, full chunks are moved out
+// to that file (which is truncated).
+// Returns false if the log could not be set up.
+static inline bool newWordLog(struct WordLog *log, const char *spill_fn) {
+    log->chunks = calloc(WORDLOG_MAX_CHUNKS, sizeof(*log->chunks));
+    if (log->chunks == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return false;
+    }
+    atomic_init(&log->next, 0);
+    log->spilled = 0;
+    log->spill_failed = false;
+    log->spill = NULL;
+    if (spill_fn != NULL) {
+        log->spill = fopen(spill_fn, "w+b");
+        if (log->spill == NULL) {
+            perror("ERROR: fopen() failed");
+            free(log->chunks);
+            return false;
+        }
+    }
+    pthread_mutex_init(&log->spill_mutex, NULL);
+    return true;
+}
+
+static inline void freeWordLog(struct WordLog *log) {
+    for (size_t i = 0; i < WORDLOG_MAX_CHUNKS; i++) {
+        struct WordChunk *chunk = atomic_load(log->chunks + i);
+        if (chunk != WORDLOG_SPILLED)
+            free(chunk);
+    }
+    free(log->chunks);
+    if (log->spill != NULL)
+        fclose(log->spill);
+    pthread_mutex_destroy(&log->spill_mutex);
+}
+
+// Writes every full chunk at the front of the log to the spill file.
+static inline void spillWordLog(struct WordLog *log) {
+    pthread_mutex_lock(&log->spill_mutex);
+    while (!log->spill_failed && log->spilled < WORDLOG_MAX_CHUNKS) {
+        struct WordChunk *chunk = atomic_load(log->chunks + log->spilled);
+        if (chunk == NULL ||
+            atomic_load_explicit(&chunk->filled, memory_order_acquire) !=
+                WORDLOG_CHUNK)
+            break;
+
+        if (fwrite(chunk->words, sizeof(word_key), WORDLOG_CHUNK,
+                   log->spill) != WORDLOG_CHUNK ||
+            fflush(log->spill) != 0) {
+            // Keep everything from here on in memory. What made it to the
+            // file is still there.
+            perror("ERROR: fwrite() to the word log failed");
+            log->spill_failed = true;
+            break;
+        }
+        atomic_store(log->chunks + log->spilled, WORDLOG_SPILLED);
+        free(chunk);
+        log->spilled++;
+    }
+    pthread_mutex_unlock(&log->spill_mutex);
+}
+
+// Adds the packed word key to the end of the log.
+// Returns false if the log is full or a chunk could not be allocated.
+static inline bool appendWordLog(struct WordLog *log, word_key key) {
+    size_t pos = atomic_fetch_add_explicit(&log->next, 1, memory_order_relaxed);
+    size_t c = pos / WORDLOG_CHUNK;
+    if (c >= WORDLOG_MAX_CHUNKS) {
+        fprintf(stderr, "ERROR: too many games for the word log\n");
+        return false;
+    }
+
+    struct WordChunk *chunk = atomic_load(log->chunks + c);
+    if (chunk == NULL) {
+        struct WordChunk *fresh = malloc(sizeof(struct WordChunk));
+        if (fresh == NULL) {
+            fprintf(stderr, "ERROR: malloc() failed\n");
+            return false;
+        }
+        atomic_init(&fresh->filled, 0);
+        if (atomic_compare_exchange_strong(log->chunks + c, &chunk, fresh)) {
+            chunk = fresh;
+        } else {
+            // Somebody else got there first, chunk is theirs now.
+            free(fresh);
+        }
+    }
+
+    chunk->words[pos % WORDLOG_CHUNK] = key;
+    unsigned filled = atomic_fetch_add_explicit(&chunk->filled, 1,
+                                                memory_order_acq_rel) +
+                      1;
+    if (filled == WORDLOG_CHUNK && log->spill != NULL)
+        spillWordLog(log);
+    return true;
+}
+
+// Builds the NULL terminated list of uppercase words in the log, each one
+// its own allocation. Only call this once nothing is appending any more.
+// Returns NULL on error.
+static inline char **viewWordLog(struct WordLog *log) {
+    size_t n = atomic_load(&log->next);
+    if (n > (size_t)WORDLOG_MAX_CHUNKS * WORDLOG_CHUNK)
+        n = (size_t)WORDLOG_MAX_CHUNKS * WORDLOG_CHUNK;
+
+    char **view = calloc(n + 1, sizeof(char *));
+    if (view == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return NULL;
+    }
+    if (log->spilled > 0 && fseek(log->spill, 0, SEEK_SET) == -1) {
+        perror("ERROR: fseek() on the word log failed");
+        free(view);
+        return NULL;
+    }
+
+    word_key buffer[WORDLOG_CHUNK];
+    size_t i = 0;
+    for (size_t c = 0; i < n; c++) {
+        const word_key *words;
+        size_t count = WORDLOG_CHUNK;
+        struct WordChunk *chunk = atomic_load(log->chunks + c);
+
+        if (chunk == WORDLOG_SPILLED) {
+            if (fread(buffer, sizeof(word_key), WORDLOG_CHUNK, log->spill) !=
+                WORDLOG_CHUNK) {
+                fprintf(stderr, "ERROR: could not read back the word log\n");
+                break;
+            }
+            words = buffer;
+        } else if (chunk != NULL) {
+            // Only the last chunk is short, unless appending ran out of
+            // memory part way through one.
+            count = atomic_load(&chunk->filled);
+            words = chunk->words;
+        } else {
+            break;
+        }
+
+        for (size_t j = 0; j < count && i < n; j++, i++) {
+            char *word = malloc(WORD_LEN + 1);
+            if (word == NULL) {
+                fprintf(stderr, "ERROR: malloc() failed\n");
+                return view;
+            }
+            unpackWord(words[j], word);
+            for (int k = 0; k < WORD_LEN; k++)
+                word[k] -= 'a' - 'A';
+            view[i] = word;
+        }
+    }
+    return view;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef WORDLE_H
+#define WORDLE_H
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Dictionary.h"
+/*
+  The wordle scoring algorithm, on packed words (see Dictionary.h).
+  The feedback for a guess is returned as a pattern code from 0 to
+  3^WORD_LEN - 1 (242 for 5 letters): each letter of the guess gets a digit
+  in base 3 (0 for a wrong letter, 1 for a right letter in the wrong spot, 2
+  for a right letter in the right spot), with the first letter in the
+  lowest digit. A code fits in a byte for up to 5 letters, and in 2 bytes
+  for the rest.
+  None of these functions allocate or take locks, so they are safe to call
+  from any thread.
+*/
+
+#define PATTERN_GRAY 0
+#define PATTERN_YELLOW 1
+#define PATTERN_GREEN 2
+#if WORD_LEN == 4
+#define NUM_PATTERNS 81
+#elif WORD_LEN == 5
+#define NUM_PATTERNS 243
+#elif WORD_LEN == 6
+#define NUM_PATTERNS 729
+#elif WORD_LEN == 7
+#define NUM_PATTERNS 2187
+#else
+#define NUM_PATTERNS 6561
+#endif
+
+// The code for a guess that is completely right.
+#define PATTERN_SOLVED (NUM_PATTERNS - 1)
+
+#if NUM_PATTERNS <= 256
+typedef uint8_t pattern_code;
+#else
+typedef uint16_t pattern_code;
+#endif
+
+// Scores guess against target, both packed words.
+static inline pattern_code scoreGuess(word_key target, word_key guess) {
+    // How many of each letter in target are not already matched in place.
+    // Letters are 0-25, so this fits in 4 machine words.
+    uint8_t unmatched[32] = {0};
+    word_key same = ~(target ^ guess);
+    unsigned green = 0;
+
+    UNROLL_WORD
+    for (int i = 0; i < WORD_LEN; i++) {
+        int shift = 5 * (WORD_LEN - 1 - i);
+        unsigned in_place = ((same >> shift) & 31) == 31;
+        green |= in_place << i;
+        unmatched[(target >> shift) & 31] += !in_place;
+    }
+
+    unsigned code = 0, digit = 1;
+    UNROLL_WORD
+    for (int i = 0; i < WORD_LEN; i++, digit *= 3) {
+        int shift = 5 * (WORD_LEN - 1 - i);
+        if (green & (1u << i)) {
+            code += PATTERN_GREEN * digit;
+        } else {
+            uint8_t *left = &unmatched[(guess >> shift) & 31];
+            unsigned yellow = *left != 0;
+            *left -= yellow;
+            code += yellow * digit;
+        }
+    }
+    return code;
+}
+
+// Scores one guess against n targets, writing one pattern code per target
+// into codes. This is the entry point for anything that needs the feedback
+// of a guess over a whole word list.
+static inline void scoreGuessBatch(word_key guess, const word_key *targets,
+                                   size_t n, pattern_code *codes) {
+    for (size_t i = 0; i < n; i++) {
+        codes[i] = scoreGuess(targets[i], guess);
+    }
+}
+
+// Turns a pattern code back into the feedback string sent to clients: a
+// right letter in the right spot is uppercase, a right letter in the wrong
+// spot is lowercase, and a wrong letter is '-'.
+// guess must be the lowercase guess the code was computed for; result needs
+// room for WORD_LEN characters and is not null terminated.
+static inline void patternToResult(pattern_code code, const char *guess,
+                                   char *result) {
+    UNROLL_WORD
+    for (int i = 0; i < WORD_LEN; i++) {
+        switch (code % 3) {
+        case PATTERN_GREEN:
+            result[i] = toupper((unsigned char)guess[i]);
+            break;
+        case PATTERN_YELLOW:
+            result[i] = guess[i];
+            break;
+        default:
+            result[i] = '-';
+            break;
+        }
+        code /= 3;
+    }
+}
+
+#endif
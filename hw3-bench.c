@@ -0,0 +1,816 @@
+/* hw3-bench.c */
+
+// Benchmarks for the server's hot paths. Every benchmark is warmed up and
+// sized to the time given, then run a few times; the report has the median
+// and best time per operation and how many heap allocations each operation
+// made. The code under test is the server's own, linked in from hw3.c.
+// The check group times nothing: it scores every pair of dictionary words
+// the way the server first did and the way it does now, and fails if any
+// pair differs.
+// Build with: gcc -Wall -O2 -pthread hw3-bench.c hw3.c -o hw3-bench.out, and
+// -DWORD_LEN=n to time the code built for n letter words.
+// USAGE: hw3-bench.out [-j] [-b <benchmark>[,...]] [-f <dictionary-filename>]
+//            [-r <runs>] [-s <seconds-per-benchmark>] [-t <max-threads>]
+
+#include <ctype.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Dictionary.h"
+#include "Journal.h"
+#include "Registry.h"
+#include "Rng.h"
+#include "Stats.h"
+#include "Ticket.h"
+#include "Wordle.h"
+
+#define DEFAULT_MAX_THREADS 64
+#define DEFAULT_SECONDS 1.0
+#define DEFAULT_RUNS 5
+#define DEFAULT_DICTIONARY "knuth.txt"
+// Operations a benchmark thread does between looking at the stop flag.
+#define BENCH_BATCH 1024
+#define MAX_RUNS 64
+// Connections left in the registry while it churns, like a busy server's.
+#define LIVE_CONNS 10000
+// The journal benchmark starts writing over its records from the top once
+// there are this many, so the file stays small.
+#define JOURNAL_RECORDS (JOURNAL_GROW * 64)
+
+// hw3.c is built for hw3-main.c, which defines these.
+int total_guesses;
+int total_wins;
+int total_losses;
+char **words;
+
+// From hw3.c.
+extern struct Stats stats;
+void evaluateWordleGuess(const char *wordle, const char *guess, char *result);
+void strlower(char *str);
+char *strupper(char *str, char *o);
+
+// Every allocation made by the code being timed goes through these, so a run
+// can count them. glibc's own entry points do the work.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+atomic_long allocations;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+// A benchmark does iterations operations and returns something computed
+// from them, which keeps the work from being optimised away.
+typedef unsigned (*bench_fn)(void *arg, long iterations);
+
+bool json = false;
+char *only = NULL; // comma separated benchmark groups to run, or NULL for all
+int runs = DEFAULT_RUNS;
+double seconds = DEFAULT_SECONDS;
+volatile unsigned sink;
+
+// The dictionary and its words as strings, for the benchmarks to work on.
+char *dict_fn = DEFAULT_DICTIONARY;
+struct Dictionary dict;
+char (*dict_words)[WORD_LEN + 1];
+// WORD_LEN letter strings that are not in the dictionary.
+#define NUM_MISSES 4096
+char miss_words[NUM_MISSES][WORD_LEN + 1];
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Whether the benchmark group was asked for.
+bool wanted(const char *group) {
+    if (only == NULL)
+        return true;
+    size_t len = strlen(group);
+    for (const char *p = only; p != NULL; p = strchr(p, ',')) {
+        if (*p == ',')
+            p++;
+        if (strncmp(p, group, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return true;
+    }
+    return false;
+}
+
+// Prints one result, as a table row or a JSON object per line.
+void report(const char *name, int threads, double *ns_per_op, int count,
+            double allocs_per_op, long ops) {
+    qsort(ns_per_op, count, sizeof(double), compareDoubles);
+    double median = ns_per_op[count / 2];
+    if (json) {
+        printf("{\"benchmark\":\"%s\",\"threads\":%d,\"ns_per_op\":%.3f,"
+               "\"min_ns_per_op\":%.3f,\"allocs_per_op\":%.3f,\"ops\":%ld,"
+               "\"runs\":%d}\n",
+               name, threads, median, ns_per_op[0], allocs_per_op, ops, count);
+    } else {
+        printf("%-20s %8d %14.1f %14.1f %12.3f %12ld\n", name, threads, median,
+               ns_per_op[0], allocs_per_op, ops);
+    }
+    fflush(stdout);
+}
+
+// Times a single threaded benchmark. It is first run with more and more
+// iterations until one run takes its share of the time, which doubles as
+// the warm up, then that many iterations are timed runs times.
+void runBench(const char *name, bench_fn fn, void *arg) {
+    double target = seconds / runs;
+    double ns_per_op[MAX_RUNS];
+    long iterations = 1;
+    double start, elapsed;
+
+    for (;;) {
+        start = now();
+        sink += fn(arg, iterations);
+        elapsed = now() - start;
+        if (elapsed >= target / 4)
+            break;
+        iterations *= 2;
+    }
+    iterations = iterations * (target / elapsed) + 1;
+
+    long before = atomic_load(&allocations);
+    for (int i = 0; i < runs; i++) {
+        start = now();
+        sink += fn(arg, iterations);
+        ns_per_op[i] = (now() - start) * 1e9 / iterations;
+    }
+    long allocs = atomic_load(&allocations) - before;
+    report(name, 1, ns_per_op, runs, (double)allocs / (iterations * runs),
+           iterations * runs);
+}
+
+struct bench_thread {
+    pthread_t tid;
+    bench_fn fn;
+    void *arg;
+    long ops;
+};
+
+atomic_bool stop_run;
+
+void *benchLoop(void *arg) {
+    struct bench_thread *t = arg;
+    unsigned total = 0;
+    long n = 0;
+
+    while (!atomic_load_explicit(&stop_run, memory_order_relaxed)) {
+        total += t->fn(t->arg, BENCH_BATCH);
+        n += BENCH_BATCH;
+    }
+    sink += total;
+    t->ops = n;
+    return NULL;
+}
+
+// Runs threads copies of a benchmark at once for duration seconds.
+// Returns the operations done by all of them together, or -1 on error.
+long runThreads(int threads, bench_fn fn, void *arg, double duration,
+                double *elapsed) {
+    struct bench_thread *pool = calloc(threads, sizeof(struct bench_thread));
+    if (pool == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return -1;
+    }
+
+    atomic_store(&stop_run, false);
+    double start = now();
+    int started;
+    for (started = 0; started < threads; started++) {
+        (pool + started)->fn = fn;
+        (pool + started)->arg = arg;
+        if (pthread_create(&(pool + started)->tid, NULL, benchLoop,
+                           pool + started) != 0) {
+            perror("ERROR: pthread_create() failed");
+            break;
+        }
+    }
+    usleep(duration * 1e6);
+    atomic_store(&stop_run, true);
+
+    long ops = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join((pool + i)->tid, NULL);
+        ops += (pool + i)->ops;
+    }
+    *elapsed = now() - start;
+    free(pool);
+    return started == threads ? ops : -1;
+}
+
+// Times a benchmark under contention, from 1 thread up to max_threads. The
+// time per operation is wall clock time over the operations every thread
+// did, so it goes down as long as adding threads helps.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int runContended(const char *name, bench_fn fn, void *arg, int max_threads) {
+    double ns_per_op[MAX_RUNS];
+    double elapsed;
+
+    // Warm up.
+    if (runThreads(1, fn, arg, seconds / runs, &elapsed) < 0)
+        return EXIT_FAILURE;
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        long before = atomic_load(&allocations);
+        long total = 0;
+        for (int i = 0; i < runs; i++) {
+            long ops = runThreads(threads, fn, arg, seconds / runs, &elapsed);
+            if (ops < 0)
+                return EXIT_FAILURE;
+            ns_per_op[i] = elapsed * 1e9 / ops;
+            total += ops;
+        }
+        // Starting the threads allocates too, which is spread too thin
+        // over the operations to show.
+        long allocs = atomic_load(&allocations) - before;
+        report(name, threads, ns_per_op, runs, (double)allocs / total, total);
+    }
+    return EXIT_SUCCESS;
+}
+
+// The benchmarks.
+
+unsigned benchEvaluate(void *arg, long iterations) {
+    (void)arg;
+    char result[WORD_LEN];
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        evaluateWordleGuess(dict_words[i % dict.size],
+                            dict_words[(i * 7 + 3) % dict.size], result);
+        total += result[i % WORD_LEN];
+    }
+    return total;
+}
+
+unsigned benchScore(void *arg, long iterations) {
+    (void)arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        total += scoreGuess(dict.words[i % dict.size],
+                            dict.words[(i * 7 + 3) % dict.size]);
+    }
+    return total;
+}
+
+unsigned benchLookupHit(void *arg, long iterations) {
+    (void)arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++)
+        total += lookupWord(&dict, dict_words[(i * 7919) % dict.size]);
+    return total;
+}
+
+unsigned benchLookupMiss(void *arg, long iterations) {
+    (void)arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++)
+        total += lookupWord(&dict, miss_words[i % NUM_MISSES]);
+    return total;
+}
+
+// The scoring the server did before Wordle.h, kept as the reference that
+// scoreGuess() is checked against.
+void evaluateOriginal(const char *wordle, const char *guess, char *result) {
+    bool wordle_used[WORD_LEN] = {false};
+    bool guess_used[WORD_LEN] = {false};
+    int i, j;
+
+    // Correct letter in correct position
+    for (i = 0; i < WORD_LEN; i++) {
+        if (*(wordle + i) == *(guess + i)) {
+            *(result + i) = toupper(*(guess + i));
+            wordle_used[i] = true;
+            guess_used[i] = true;
+        }
+    }
+
+    // Check for yellow feedback
+    for (i = 0; i < WORD_LEN; i++) {
+        if (!guess_used[i]) {
+            for (j = 0; j < WORD_LEN; j++) {
+                if (!wordle_used[j] && *(wordle + j) == *(guess + i)) {
+                    *(result + i) = *(guess + i);
+                    wordle_used[j] = true;
+                    guess_used[i] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Mark the rest as gray
+    for (i = 0; i < WORD_LEN; i++) {
+        if (!guess_used[i])
+            *(result + i) = '-';
+    }
+}
+
+// Scores every guess against every target in the dictionary, both with
+// scoreGuess() and through evaluateWordleGuess(), and compares them with
+// evaluateOriginal().
+// Returns EXIT_FAILURE if any pair differs and EXIT_SUCCESS otherwise
+int checkEvaluate() {
+    char expected[WORD_LEN], packed[WORD_LEN], evaluated[WORD_LEN];
+    long pairs = 0, mismatches = 0;
+
+    for (int t = 0; t < dict.size; t++) {
+        for (int g = 0; g < dict.size; g++, pairs++) {
+            evaluateOriginal(dict_words[t], dict_words[g], expected);
+            patternToResult(scoreGuess(dict.words[t], dict.words[g]),
+                            dict_words[g], packed);
+            evaluateWordleGuess(dict_words[t], dict_words[g], evaluated);
+            if (memcmp(expected, packed, WORD_LEN) == 0 &&
+                memcmp(expected, evaluated, WORD_LEN) == 0)
+                continue;
+            if (mismatches++ < 10)
+                fprintf(stderr,
+                        "MISMATCH: %s against %s: expected %.*s, scoreGuess() "
+                        "%.*s, evaluateWordleGuess() %.*s\n",
+                        dict_words[g], dict_words[t], WORD_LEN, expected,
+                        WORD_LEN, packed, WORD_LEN, evaluated);
+        }
+    }
+    if (json)
+        printf("{\"check\":\"evaluate\",\"pairs\":%ld,\"mismatches\":%ld}\n",
+               pairs, mismatches);
+    else
+        printf("# check/evaluate: %ld pairs, %ld mismatches\n", pairs,
+               mismatches);
+    fflush(stdout);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A dictionary file and how many words are in it.
+struct dict_file {
+    const char *fn;
+    int size;
+};
+
+unsigned benchReadDict(void *arg, long iterations) {
+    (void)arg;
+    struct dict_file *file = arg;
+    struct Dictionary loaded;
+    unsigned total = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        FILE *in = fopen(file->fn, "r");
+        if (in == NULL || readDict(in, &loaded, file->size) != 0) {
+            perror("ERROR: readDict() failed");
+            exit(EXIT_FAILURE);
+        }
+        fclose(in);
+        total += loaded.size;
+        freeDict(&loaded);
+    }
+    return total;
+}
+
+// The key the ticket benchmarks seal and open with.
+struct TicketKey bench_key = {0x0706050403020100ull, 0x0f0e0d0c0b0a0908ull,
+                              0x1716151413121110ull, 0x1f1e1d1c1b1a1918ull};
+
+unsigned benchSealTicket(void *arg, long iterations) {
+    (void)arg;
+    struct Ticket ticket = {0, 6, 0, 0};
+    char sealed[TICKET_SIZE];
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        ticket.target = i % dict.size;
+        ticket.nonce = i;
+        sealTicket(&bench_key, &ticket, sealed);
+        total += sealed[i % TICKET_SIZE];
+    }
+    return total;
+}
+
+unsigned benchOpenTicket(void *arg, long iterations) {
+    (void)arg;
+    char (*sealed)[TICKET_SIZE] = arg;
+    struct Ticket ticket;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (openTicket(&bench_key, sealed[i % dict.size], &ticket))
+            total += ticket.target;
+    }
+    return total;
+}
+
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int benchTickets() {
+    char (*sealed)[TICKET_SIZE] = calloc(dict.size, TICKET_SIZE);
+    if (sealed == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < dict.size; i++) {
+        struct Ticket ticket = {i, 6, 0, i};
+        sealTicket(&bench_key, &ticket, sealed[i]);
+    }
+    runBench("ticket/seal", benchSealTicket, NULL);
+    runBench("ticket/open", benchOpenTicket, sealed);
+    free(sealed);
+    return EXIT_SUCCESS;
+}
+
+unsigned benchStrlower(void *arg, long iterations) {
+    (void)arg;
+    char word[WORD_LEN + 1];
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        memcpy(word, dict_words[i % dict.size], WORD_LEN + 1);
+        strlower(word);
+        total += *word;
+    }
+    return total;
+}
+
+unsigned benchStrupper(void *arg, long iterations) {
+    (void)arg;
+    char word[WORD_LEN + 1];
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++)
+        total += *strupper(dict_words[i % dict.size], word);
+    return total;
+}
+
+pthread_mutex_t mutex_guesses = PTHREAD_MUTEX_INITIALIZER;
+long locked_guesses;
+
+// Plays a guess and counts it the way the server used to, under a mutex.
+unsigned benchCountMutex(void *arg, long iterations) {
+    (void)arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        total += scoreGuess(dict.words[i % dict.size],
+                            dict.words[(i + 3) % dict.size]);
+        pthread_mutex_lock(&mutex_guesses);
+        { locked_guesses++; }
+        pthread_mutex_unlock(&mutex_guesses);
+    }
+    return total;
+}
+
+// The same with the striped counters in Stats.h.
+unsigned benchCountStriped(void *arg, long iterations) {
+    (void)arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        total += scoreGuess(dict.words[i % dict.size],
+                            dict.words[(i + 3) % dict.size]);
+        countStat(&stats, STAT_GUESSES);
+    }
+    return total;
+}
+
+// The same again, journaling every guess the way a server with -j does.
+unsigned benchCountJournal(void *arg, long iterations) {
+    (void)arg;
+    struct Journal *journal = arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        pattern_code code = scoreGuess(dict.words[i % dict.size],
+                                       dict.words[(i + 3) % dict.size]);
+        countStat(&stats, STAT_GUESSES);
+        total += journalGuess(journal, i, dict.words[(i + 3) % dict.size],
+                              code);
+    }
+    if (atomic_load(&journal->header->next) > JOURNAL_RECORDS)
+        atomic_store(&journal->header->next, 0);
+    return total;
+}
+
+// Runs the journal benchmark against a new temporary journal.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int benchJournal(int max_threads) {
+    struct Journal journal;
+    char fn[] = "/tmp/hw3-bench-XXXXXX";
+    int fd = mkstemp(fn);
+    if (fd == -1) {
+        perror("ERROR: mkstemp() failed");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    if (!openJournal(&journal, fn) || startJournal(&journal) != 0) {
+        unlink(fn);
+        return EXIT_FAILURE;
+    }
+    int rc = runContended("count/journal", benchCountJournal, &journal,
+                          max_threads);
+    closeJournal(&journal);
+    unlink(fn);
+    return rc;
+}
+
+// A game thread's connection going into and coming out of the registry, the
+// way the accept loop and the thread do. removeRegistry() closes the
+// connection's socket, so they all carry -1.
+unsigned benchRegistry(void *arg, long iterations) {
+    (void)arg;
+    struct Registry *reg = arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++)
+        total += removeRegistry(reg, addRegistry(reg, -1));
+    return total;
+}
+
+// Churns the registry empty and then with LIVE_CONNS connections in it.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int benchRegistries(int max_threads) {
+    struct Registry *reg = newRegistry();
+    if (reg == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return EXIT_FAILURE;
+    }
+    int rc = runContended("registry", benchRegistry, reg, max_threads);
+    for (int i = 0; i < LIVE_CONNS && rc == EXIT_SUCCESS; i++) {
+        if (addRegistry(reg, -1) == NO_CONN) {
+            fprintf(stderr, "ERROR: malloc() failed\n");
+            rc = EXIT_FAILURE;
+        }
+    }
+    if (rc == EXIT_SUCCESS)
+        rc = runContended("registry/10k-live", benchRegistry, reg,
+                          max_threads);
+    freeRegistry(reg);
+    return rc;
+}
+
+// Writes size random words to a new temporary file.
+// Returns false on error.
+bool writeWords(char *fn, int size, uint64_t seed) {
+    int fd = mkstemp(fn);
+    if (fd == -1) {
+        perror("ERROR: mkstemp() failed");
+        return false;
+    }
+    FILE *out = fdopen(fd, "w");
+    if (out == NULL) {
+        perror("ERROR: fdopen() failed");
+        close(fd);
+        return false;
+    }
+    struct Rng rng;
+    char word[WORD_LEN + 1];
+    seedRng(&rng, seed, 0);
+    word[WORD_LEN] = '\0';
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < WORD_LEN; j++)
+            word[j] = 'a' + boundedRng(&rng, 26);
+        fprintf(out, "%s\n", word);
+    }
+    if (fclose(out) != 0) {
+        perror("ERROR: fclose() failed");
+        return false;
+    }
+    return true;
+}
+
+// Times reading the dictionary the server was given, and random ones of a
+// few bigger sizes.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+// A dictionary of generated words, for the lookup benchmarks by size.
+struct lookup_dict {
+    struct Dictionary dict;
+    char (*words)[WORD_LEN + 1];
+};
+
+unsigned benchLookupSized(void *arg, long iterations) {
+    (void)arg;
+    struct lookup_dict *set = arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++)
+        total += lookupWord(&set->dict,
+                            set->words[(i * 7919) % set->dict.size]);
+    return total;
+}
+
+// How guesses were checked before the index: a strcmp() over every word
+// until one matches.
+unsigned benchLookupScan(void *arg, long iterations) {
+    (void)arg;
+    struct lookup_dict *set = arg;
+    unsigned total = 0;
+    for (long i = 0; i < iterations; i++) {
+        const char *guess = set->words[(i * 7919) % set->dict.size];
+        int j = 0;
+        while (j < set->dict.size && strcmp(set->words[j], guess) != 0)
+            j++;
+        total += j;
+    }
+    return total;
+}
+
+// Times the index against the scan it replaced, on dictionaries of
+// generated words of a few sizes.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int benchLookups() {
+    static const int sizes[] = {5000, 15000, 100000};
+    char name[64];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        char fn[] = "/tmp/hw3-bench-XXXXXX";
+        struct lookup_dict set;
+        if (!writeWords(fn, sizes[i], i + 16))
+            return EXIT_FAILURE;
+        FILE *in = fopen(fn, "r");
+        int rc = in != NULL ? readDict(in, &set.dict, sizes[i])
+                            : EXIT_FAILURE;
+        if (in != NULL)
+            fclose(in);
+        unlink(fn);
+        if (rc != EXIT_SUCCESS) {
+            fprintf(stderr, "ERROR: could not read back %s\n", fn);
+            return EXIT_FAILURE;
+        }
+        set.words = calloc(set.dict.size, WORD_LEN + 1);
+        if (set.words == NULL) {
+            fprintf(stderr, "ERROR: calloc() failed\n");
+            freeDict(&set.dict);
+            return EXIT_FAILURE;
+        }
+        for (int j = 0; j < set.dict.size; j++)
+            unpackWord(set.dict.words[j], set.words[j]);
+
+        snprintf(name, sizeof(name), "lookup/%d/index", sizes[i]);
+        runBench(name, benchLookupSized, &set);
+        snprintf(name, sizeof(name), "lookup/%d/scan", sizes[i]);
+        runBench(name, benchLookupScan, &set);
+        free(set.words);
+        freeDict(&set.dict);
+    }
+    return EXIT_SUCCESS;
+}
+
+int benchReadDicts() {
+    static const int sizes[] = {100000, 1000000};
+    struct dict_file file = {dict_fn, dict.size};
+    char name[64];
+    runBench("readdict/file", benchReadDict, &file);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        char fn[] = "/tmp/hw3-bench-XXXXXX";
+        if (!writeWords(fn, sizes[i], i))
+            return EXIT_FAILURE;
+        file.fn = fn;
+        file.size = sizes[i];
+        snprintf(name, sizeof(name), "readdict/%d", sizes[i]);
+        runBench(name, benchReadDict, &file);
+        unlink(fn);
+    }
+    return EXIT_SUCCESS;
+}
+
+// Loads the dictionary the benchmarks work on, with as many words as the
+// file has.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int loadBenchDict() {
+    char word[DICT_WORD_SIZE];
+    int size = 0;
+
+    FILE *in = fopen(dict_fn, "r");
+    if (in == NULL) {
+        perror("ERROR: open() failed");
+        return EXIT_FAILURE;
+    }
+    while (fscanf(in, "%256s", word) == 1)
+        size++;
+    rewind(in);
+    int rc = size > 0 ? readDict(in, &dict, size) : EXIT_FAILURE;
+    fclose(in);
+    if (rc != EXIT_SUCCESS) {
+        fprintf(stderr, "ERROR: no words in %s\n", dict_fn);
+        return EXIT_FAILURE;
+    }
+
+    dict_words = calloc(dict.size, WORD_LEN + 1);
+    if (dict_words == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        freeDict(&dict);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < dict.size; i++)
+        unpackWord(dict.words[i], dict_words[i]);
+
+    struct Rng rng;
+    seedRng(&rng, 0, 1);
+    for (int i = 0; i < NUM_MISSES; i++) {
+        do {
+            for (int j = 0; j < WORD_LEN; j++)
+                miss_words[i][j] = 'a' + boundedRng(&rng, 26);
+        } while (lookupWord(&dict, miss_words[i]) != NO_WORD);
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = DEFAULT_MAX_THREADS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:f:jr:s:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            only = optarg;
+            break;
+        case 'f':
+            dict_fn = optarg;
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 's':
+            seconds = atof(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "USAGE: %s [-j] [-b <benchmark>[,...]] "
+                    "[-f <dictionary-filename>] [-r <runs>] "
+                    "[-s <seconds-per-benchmark>] [-t <max-threads>]\n"
+                    "benchmarks: evaluate lookup readdict case count "
+                    "journal registry ticket check\n",
+                    *argv);
+            return EXIT_FAILURE;
+        }
+    }
+    if (max_threads < 1 || seconds <= 0 || runs < 1 || runs > MAX_RUNS) {
+        fprintf(stderr, "ERROR: Invalid argument(s)\n");
+        return EXIT_FAILURE;
+    }
+    if (loadBenchDict() != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (!json) {
+        printf("# %s (%d words), %d runs, %ld cores online\n", dict_fn,
+               dict.size, runs, sysconf(_SC_NPROCESSORS_ONLN));
+        printf("%-20s %8s %14s %14s %12s %12s\n", "benchmark", "threads",
+               "ns/op", "best ns/op", "allocs/op", "ops");
+    }
+
+    int rc = EXIT_SUCCESS;
+    if (wanted("evaluate")) {
+        runBench("evaluate", benchEvaluate, NULL);
+        runBench("evaluate/packed", benchScore, NULL);
+    }
+    if (wanted("lookup")) {
+        runBench("lookup/hit", benchLookupHit, NULL);
+        runBench("lookup/miss", benchLookupMiss, NULL);
+        rc = benchLookups();
+    }
+    if (wanted("readdict") && rc == EXIT_SUCCESS)
+        rc = benchReadDicts();
+    if (wanted("case")) {
+        runBench("strlower", benchStrlower, NULL);
+        runBench("strupper", benchStrupper, NULL);
+    }
+    if (wanted("count") && rc == EXIT_SUCCESS) {
+        rc = runContended("count/mutex", benchCountMutex, NULL, max_threads);
+        if (rc == EXIT_SUCCESS)
+            rc = runContended("count/striped", benchCountStriped, NULL,
+                              max_threads);
+    }
+    if (wanted("journal") && rc == EXIT_SUCCESS)
+        rc = benchJournal(max_threads);
+    if (wanted("registry") && rc == EXIT_SUCCESS)
+        rc = benchRegistries(max_threads);
+    if (wanted("ticket") && rc == EXIT_SUCCESS)
+        rc = benchTickets();
+    if (wanted("check") && rc == EXIT_SUCCESS)
+        rc = checkEvaluate();
+
+    free(dict_words);
+    freeDict(&dict);
+    return rc;
+}
@@ -0,0 +1,594 @@
+/* hw3-load.c */
+
+// Closed loop load generator for the wordle server, grown out of
+// hw3-client.c. Every connection plays whole games with random words from
+// the dictionary, sending its next guess as soon as the reply to the last one
+// is in, and the threads report connection setup and round trip latencies.
+// With v1 every game is a new connection; with -2 each connection speaks
+// protocol v2 (see Protocol.h) and plays its games back to back. With -p a
+// v1 connection sends that many guesses at once instead of one at a time.
+// With -i every connection plays one guess and then sits on its game until
+// the time is up, to see what idle games cost the server. With -S the v2
+// games are stateless, played with the tickets the server hands out.
+// Build with: gcc -Wall -O2 -pthread hw3-load.c -o hw3-load.out, with the
+// same -DWORD_LEN as the server.
+// USAGE: hw3-load.out [-2] [-i] [-S] [-v] [-c <connections>] [-p <depth>]
+//            [-t <threads>] [-d <seconds> | -g <games>] [-s <seed>] <host>
+//            <port> <dictionary-filename> <num-words>
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Dictionary.h"
+#include "Histogram.h"
+#include "Protocol.h"
+#include "Rng.h"
+
+#define DEFAULT_CONNECTIONS 64
+#define DEFAULT_SECONDS 10.0
+#define LOAD_EVENTS 64
+// How long a thread sleeps in epoll_wait() before checking the clock.
+#define LOAD_TICK_MS 100
+#define V1_REPLY_SIZE (4 + WORD_LEN)
+#define V1_GUESSES 6
+#define LOAD_IN_SIZE 64
+
+enum load_state { LOAD_CONNECTING, LOAD_HELLO, LOAD_PLAYING };
+
+struct load_conn {
+    int sd; // -1 once the connection is done with
+    enum load_state state;
+    uint32_t game; // name of the v2 game being played
+    uint64_t sent_at;
+    char ticket[V2_TICKET_SIZE]; // of the stateless game being played
+    int sent;                    // v1 guesses sent so far
+    int outstanding; // v1 guesses not answered yet
+    char in[LOAD_IN_SIZE];
+    int in_len;
+};
+
+struct load_thread {
+    pthread_t tid;
+    int epfd;
+    struct Rng rng;
+    struct load_conn *conns;
+    int num_conns;
+    int active;
+    long connects;
+    long games;
+    long wins;
+    long guesses;
+    long invalid;
+    long errors;
+    struct Histogram connect_ns;
+    struct Histogram guess_ns;
+};
+
+struct addrinfo *server_addrs;
+struct Dictionary dict;
+bool use_v2 = false;
+bool stateless = false;
+int pipeline = 1; // v1 guesses sent at once
+bool idle = false; // stop after the first guess of every game
+long max_games = 0; // 0 to run for a fixed time instead
+atomic_long games_claimed;
+atomic_bool stop_run;
+uint64_t deadline;
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Takes a ticket for one more game.
+// Returns false once the run has played (or started) all it is meant to.
+bool claimGame() {
+    if (atomic_load_explicit(&stop_run, memory_order_relaxed))
+        return false;
+    return max_games == 0 || atomic_fetch_add(&games_claimed, 1) < max_games;
+}
+
+void closeLoadConn(struct load_thread *t, struct load_conn *c) {
+    close(c->sd);
+    c->sd = -1;
+    t->active--;
+}
+
+bool watchLoadConn(struct load_thread *t, struct load_conn *c, int op,
+                   uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    if (epoll_ctl(t->epfd, op, c->sd, &ev) == -1) {
+        perror("ERROR: epoll_ctl() failed");
+        return false;
+    }
+    return true;
+}
+
+// Sends the whole request, which always fits in an empty socket buffer.
+bool sendRequest(struct load_thread *t, struct load_conn *c, const void *buf,
+                 int len) {
+    if (send(c->sd, buf, len, MSG_NOSIGNAL) != len) {
+        t->errors++;
+        return false;
+    }
+    return true;
+}
+
+bool sendGuess(struct load_thread *t, struct load_conn *c) {
+    char word[WORD_LEN + 1];
+    char frame[V2_MAX_FRAME];
+    char guesses[WORD_LEN * V1_GUESSES + V2_TICKET_SIZE + 1];
+    int n = 0;
+
+    c->sent_at = nowNs();
+    if (stateless) {
+        memcpy(guesses, c->ticket, V2_TICKET_SIZE);
+        unpackWord(*(dict.words + boundedRng(&t->rng, dict.size)),
+                   guesses + V2_TICKET_SIZE);
+        return sendRequest(t, c, frame,
+                           putFrame(frame, V2_PLAY, c->game, guesses,
+                                    V2_TICKET_SIZE + WORD_LEN));
+    }
+    if (use_v2) {
+        unpackWord(*(dict.words + boundedRng(&t->rng, dict.size)), word);
+        return sendRequest(t, c, frame,
+                           putFrame(frame, V2_GUESS, c->game, word, WORD_LEN));
+    }
+    // The next pipeline guesses, or as many as the game has left.
+    while (n < pipeline && c->sent < V1_GUESSES) {
+        unpackWord(*(dict.words + boundedRng(&t->rng, dict.size)),
+                   guesses + WORD_LEN * n++);
+        c->sent++;
+    }
+    c->outstanding = n;
+    return sendRequest(t, c, guesses, WORD_LEN * n);
+}
+
+// Starts the connection's next v2 game, or closes it if there are no more
+// games to play.
+bool sendStart(struct load_thread *t, struct load_conn *c) {
+    char frame[V2_MAX_FRAME];
+
+    if (!claimGame())
+        return false;
+    c->game++;
+    return sendRequest(t, c, frame,
+                       putFrame(frame, stateless ? V2_TICKET : V2_START,
+                                c->game, NULL, 0));
+}
+
+// Called once the connection to the server is up.
+bool loadConnected(struct load_thread *t, struct load_conn *c) {
+    recordHist(&t->connect_ns, nowNs() - c->sent_at);
+    t->connects++;
+    if (!watchLoadConn(t, c, EPOLL_CTL_MOD, EPOLLIN))
+        return false;
+    if (!use_v2) {
+        c->state = LOAD_PLAYING;
+        return sendGuess(t, c);
+    }
+    c->state = LOAD_HELLO;
+    return sendRequest(t, c, V2_HELLO, V2_HELLO_SIZE);
+}
+
+// Opens a connection to the server for the slot c. A v1 connection plays a
+// single game, so it takes its ticket up front.
+// Returns false if the slot has nothing more to do.
+bool openLoadConn(struct load_thread *t, struct load_conn *c) {
+    struct addrinfo *ai;
+
+    if (!use_v2 && !claimGame())
+        return false;
+
+    memset(c, 0, sizeof(struct load_conn));
+    c->sd = -1;
+    for (ai = server_addrs; ai != NULL; ai = ai->ai_next) {
+        c->sd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK,
+                       ai->ai_protocol);
+        if (c->sd == -1)
+            continue;
+        c->sent_at = nowNs();
+        if (connect(c->sd, ai->ai_addr, ai->ai_addrlen) == 0 ||
+            errno == EINPROGRESS)
+            break;
+        close(c->sd);
+        c->sd = -1;
+    }
+    if (c->sd == -1) {
+        perror("ERROR: connect() failed");
+        t->errors++;
+        return false;
+    }
+
+    t->active++;
+    c->state = LOAD_CONNECTING;
+    if (!watchLoadConn(t, c, EPOLL_CTL_ADD, EPOLLOUT)) {
+        closeLoadConn(t, c);
+        return false;
+    }
+    return true;
+}
+
+// Counts the reply to a guess. type is 'Y' or 'N', and result the WORD_LEN
+// characters of feedback.
+// Returns true if the game is over.
+bool countReply(struct load_thread *t, struct load_conn *c, char type,
+                int guesses_left, const char *result) {
+    bool won = type == 'Y';
+
+    recordHist(&t->guess_ns, nowNs() - c->sent_at);
+    t->guesses++;
+    if (type != 'Y')
+        t->invalid++;
+    for (int i = 0; i < WORD_LEN && won; i++)
+        won = result[i] >= 'A' && result[i] <= 'Z';
+    if (!won && guesses_left > 0)
+        return false;
+    t->games++;
+    t->wins += won;
+    return true;
+}
+
+// Handles every complete v1 reply in the connection's input. The round trip
+// of a pipelined guess is timed from when its batch was sent.
+// Returns false if the connection is done with.
+bool readV1(struct load_thread *t, struct load_conn *c) {
+    short net_short;
+    int used = 0;
+
+    for (; c->in_len - used >= V1_REPLY_SIZE; used += V1_REPLY_SIZE) {
+        if (c->outstanding == 0) {
+            fprintf(stderr, "ERROR: server sent more replies than guesses\n");
+            t->errors++;
+            return false;
+        }
+        c->outstanding--;
+        memcpy(&net_short, c->in + used + 1, sizeof(short));
+        if (countReply(t, c, *(c->in + used), ntohs(net_short),
+                       c->in + used + 3)) {
+            // The server hangs up after the game; a new one needs a new
+            // connection.
+            closeLoadConn(t, c);
+            return openLoadConn(t, c);
+        }
+    }
+    memmove(c->in, c->in + used, c->in_len - used);
+    c->in_len -= used;
+    if (c->outstanding > 0 || idle)
+        return true;
+    return sendGuess(t, c);
+}
+
+// Handles the hello and every complete frame in the connection's input.
+// Returns false if the connection is done with.
+bool readV2(struct load_thread *t, struct load_conn *c) {
+    struct Frame frame;
+    short net_short;
+    int used = 0;
+    int size;
+
+    if (c->state == LOAD_HELLO) {
+        if (c->in_len < V2_HELLO_SIZE)
+            return true;
+        if (memcmp(c->in, V2_HELLO, V2_HELLO_SIZE) != 0) {
+            fprintf(stderr, "ERROR: server does not speak protocol v2\n");
+            t->errors++;
+            return false;
+        }
+        used = V2_HELLO_SIZE;
+        c->state = LOAD_PLAYING;
+        if (!sendStart(t, c))
+            return false;
+    }
+
+    while ((size = parseFrame(c->in + used, c->in_len - used, &frame)) > 0) {
+        used += size;
+        switch (frame.type) {
+        case V2_TICKETED:
+            if (frame.payload_len != V2_TICKETED_SIZE)
+                break;
+            memcpy(c->ticket, frame.payload + sizeof(short), V2_TICKET_SIZE);
+            // fall through
+        case V2_STARTED:
+            if (!sendGuess(t, c))
+                return false;
+            break;
+        case V2_VALID:
+        case V2_INVALID:
+            // A stateless game's next ticket comes after the result.
+            if (frame.payload_len == V2_RESULT_SIZE + V2_TICKET_SIZE)
+                memcpy(c->ticket, frame.payload + V2_RESULT_SIZE,
+                       V2_TICKET_SIZE);
+            else if (frame.payload_len != V2_RESULT_SIZE)
+                break;
+            memcpy(&net_short, frame.payload, sizeof(short));
+            if (!countReply(t, c, frame.type, ntohs(net_short),
+                            frame.payload + sizeof(short))) {
+                if (!idle && !sendGuess(t, c))
+                    return false;
+            } else if (!sendStart(t, c)) {
+                return false;
+            }
+            break;
+        default:
+            fprintf(stderr, "ERROR: server sent a '%c' frame\n", frame.type);
+            t->errors++;
+            return false;
+        }
+    }
+    if (size == -1) {
+        fprintf(stderr, "ERROR: server sent a malformed frame\n");
+        t->errors++;
+        return false;
+    }
+    memmove(c->in, c->in + used, c->in_len - used);
+    c->in_len -= used;
+    return true;
+}
+
+// Runs a connection forward after epoll reports it ready.
+// Returns false if the connection is done with.
+bool serviceLoadConn(struct load_thread *t, struct load_conn *c) {
+    if (c->state == LOAD_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->sd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            errno = err;
+            perror("ERROR: connect() failed");
+            t->errors++;
+            return false;
+        }
+        return loadConnected(t, c);
+    }
+
+    int n = recv(c->sd, c->in + c->in_len, LOAD_IN_SIZE - c->in_len, 0);
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return true;
+        perror("ERROR: recv() failed");
+        t->errors++;
+        return false;
+    } else if (n == 0) {
+        fprintf(stderr, "ERROR: server closed the connection mid game\n");
+        t->errors++;
+        return false;
+    }
+    c->in_len += n;
+    return use_v2 ? readV2(t, c) : readV1(t, c);
+}
+
+void *loadLoop(void *arg) {
+    struct load_thread *t = arg;
+    struct epoll_event events[LOAD_EVENTS];
+    int n;
+
+    for (int i = 0; i < t->num_conns; i++) {
+        if (!openLoadConn(t, t->conns + i))
+            (t->conns + i)->sd = -1;
+    }
+
+    while (t->active > 0) {
+        n = epoll_wait(t->epfd, events, LOAD_EVENTS, LOAD_TICK_MS);
+        if (n == -1 && errno != EINTR) {
+            perror("ERROR: epoll_wait() failed");
+            break;
+        }
+        if (max_games == 0 && nowNs() >= deadline)
+            atomic_store(&stop_run, true);
+        if (atomic_load_explicit(&stop_run, memory_order_relaxed))
+            break;
+
+        for (int i = 0; i < n; i++) {
+            struct load_conn *c = events[i].data.ptr;
+            if (c->sd != -1 && !serviceLoadConn(t, c) && c->sd != -1)
+                closeLoadConn(t, c);
+        }
+    }
+
+    // Games still going when the time is up are just dropped.
+    for (int i = 0; i < t->num_conns; i++) {
+        if ((t->conns + i)->sd != -1)
+            closeLoadConn(t, t->conns + i);
+    }
+    return NULL;
+}
+
+int usage(const char *prog) {
+    fprintf(stderr,
+            "ERROR: Invalid argument(s)\nUSAGE: %s [-2] [-i] [-S] [-v] "
+            "[-c <connections>] [-p <depth>] [-t <threads>] "
+            "[-d <seconds> | -g <games>] "
+            "[-s <seed>] <host> <port> <dictionary-filename> <num-words>\n",
+            prog);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    int connections = DEFAULT_CONNECTIONS;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = DEFAULT_SECONDS;
+    unsigned int seed = 0;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "2c:d:g:ip:s:St:v")) != -1) {
+        switch (opt) {
+        case '2':
+            use_v2 = true;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d", &connections) != 1 || connections < 1)
+                return usage(*argv);
+            break;
+        case 'd':
+            if (sscanf(optarg, "%lf", &seconds) != 1 || seconds <= 0)
+                return usage(*argv);
+            break;
+        case 'g':
+            if (sscanf(optarg, "%ld", &max_games) != 1 || max_games < 1)
+                return usage(*argv);
+            break;
+        case 'i':
+            idle = true;
+            break;
+        case 'p':
+            if (sscanf(optarg, "%d", &pipeline) != 1 || pipeline < 1 ||
+                pipeline > V1_GUESSES)
+                return usage(*argv);
+            break;
+        case 's':
+            if (sscanf(optarg, "%u", &seed) != 1)
+                return usage(*argv);
+            break;
+        case 'S':
+            use_v2 = stateless = true;
+            break;
+        case 't':
+            if (sscanf(optarg, "%d", &threads) != 1 || threads < 1)
+                return usage(*argv);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            return usage(*argv);
+        }
+    }
+    // Idle games never finish, so only a run for a fixed time ends.
+    if (argc - optind != 4 || (idle && max_games > 0))
+        return usage(*argv);
+    if (threads < 1)
+        threads = 1;
+    if (threads > connections)
+        threads = connections;
+
+    int dict_size;
+    if (sscanf(*(argv + optind + 3), "%d", &dict_size) != 1 || dict_size < 1 ||
+        dict_size > DICT_MAX_WORDS)
+        return usage(*argv);
+    FILE *dict_in = fopen(*(argv + optind + 2), "r");
+    if (dict_in == NULL) {
+        perror("ERROR: open() failed");
+        return EXIT_FAILURE;
+    }
+    int rc = readDict(dict_in, &dict, dict_size);
+    fclose(dict_in);
+    if (rc != EXIT_SUCCESS)
+        return rc;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    rc = getaddrinfo(*(argv + optind), *(argv + optind + 1), &hints,
+                     &server_addrs);
+    if (rc != 0) {
+        fprintf(stderr, "ERROR: getaddrinfo() failed: %s\n", gai_strerror(rc));
+        freeDict(&dict);
+        return EXIT_FAILURE;
+    }
+
+    struct load_thread *pool = calloc(threads, sizeof(struct load_thread));
+    struct load_conn *conns = calloc(connections, sizeof(struct load_conn));
+    if (pool == NULL || conns == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        free(pool);
+        free(conns);
+        freeaddrinfo(server_addrs);
+        freeDict(&dict);
+        return EXIT_FAILURE;
+    }
+
+    printf("LOAD: %d connection%s over %d thread%s, protocol v%d%s, ",
+           connections, connections == 1 ? "" : "s", threads,
+           threads == 1 ? "" : "s", use_v2 ? 2 : 1,
+           stateless ? " stateless" : "");
+    if (max_games > 0)
+        printf("%ld games\n", max_games);
+    else
+        printf("%.1fs\n", seconds);
+
+    atomic_init(&games_claimed, 0);
+    atomic_init(&stop_run, false);
+    uint64_t start = nowNs();
+    deadline = start + (uint64_t)(seconds * 1e9);
+    int started;
+    for (started = 0; started < threads; started++) {
+        struct load_thread *t = pool + started;
+        // Spread the connections as evenly as they go.
+        int first = (long)connections * started / threads;
+        t->conns = conns + first;
+        t->num_conns = (long)connections * (started + 1) / threads - first;
+        seedRng(&t->rng, seed, started);
+        clearHist(&t->connect_ns);
+        clearHist(&t->guess_ns);
+        t->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (t->epfd == -1) {
+            perror("ERROR: epoll_create1() failed");
+            break;
+        }
+        if (pthread_create(&t->tid, NULL, loadLoop, t) != 0) {
+            perror("ERROR: pthread_create() failed");
+            close(t->epfd);
+            break;
+        }
+    }
+    if (started < threads)
+        atomic_store(&stop_run, true);
+
+    struct load_thread total;
+    memset(&total, 0, sizeof(total));
+    clearHist(&total.connect_ns);
+    clearHist(&total.guess_ns);
+    for (int i = 0; i < started; i++) {
+        struct load_thread *t = pool + i;
+        pthread_join(t->tid, NULL);
+        close(t->epfd);
+        total.connects += t->connects;
+        total.games += t->games;
+        total.wins += t->wins;
+        total.guesses += t->guesses;
+        total.invalid += t->invalid;
+        total.errors += t->errors;
+        mergeHist(&total.connect_ns, &t->connect_ns);
+        mergeHist(&total.guess_ns, &t->guess_ns);
+    }
+    double elapsed = (nowNs() - start) / 1e9;
+
+    printf("LOAD: ran for %.2fs with %ld error%s\n", elapsed, total.errors,
+           total.errors == 1 ? "" : "s");
+    printf("LOAD: %ld connections (%.1f/s)\n", total.connects,
+           total.connects / elapsed);
+    printf("LOAD: %ld games (%ld won), %ld guesses (%.1f/s, %ld invalid)\n",
+           total.games, total.wins, total.guesses, total.guesses / elapsed,
+           total.invalid);
+    printf("# latency in microseconds\n");
+    printHist(stdout, "connect", &total.connect_ns, 1000);
+    printHist(stdout, "round trip", &total.guess_ns, 1000);
+    if (verbose) {
+        printf("# round trip distribution in microseconds\n");
+        printHistDistribution(stdout, &total.guess_ns, 1000);
+    }
+
+    free(pool);
+    free(conns);
+    freeaddrinfo(server_addrs);
+    freeDict(&dict);
+    return started == threads ? EXIT_SUCCESS : EXIT_FAILURE;
+}
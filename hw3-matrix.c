@@ -0,0 +1,70 @@
+/* hw3-matrix.c */
+
+// Builds the feedback matrix for a dictionary (see Matrix.h), for the server
+// to load with -p.
+// Build with: gcc -Wall -O2 -pthread hw3-matrix.c -o hw3-matrix.out, with the
+// same -DWORD_LEN as the server.
+// USAGE: hw3-matrix.out [-t <threads>] <dictionary-filename> <num-words>
+//            <matrix-filename>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Dictionary.h"
+#include "Matrix.h"
+
+int usage(const char *prog) {
+    fprintf(stderr,
+            "ERROR: Invalid argument(s)\nUSAGE: %s [-t <threads>] "
+            "<dictionary-filename> <num-words> <matrix-filename>\n",
+            prog);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    if (threads < 1)
+        threads = 1;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt != 't' || sscanf(optarg, "%d", &threads) != 1 || threads < 1)
+            return usage(*argv);
+    }
+    if (argc - optind != 3)
+        return usage(*argv);
+
+    int dict_size;
+    if (sscanf(*(argv + optind + 1), "%d", &dict_size) != 1 || dict_size < 1 ||
+        dict_size > DICT_MAX_WORDS)
+        return usage(*argv);
+
+    FILE *dict_in = fopen(*(argv + optind), "r");
+    if (dict_in == NULL) {
+        perror("ERROR: open() failed");
+        return EXIT_FAILURE;
+    }
+    struct Dictionary dict;
+    int rc = readDict(dict_in, &dict, dict_size);
+    fclose(dict_in);
+    if (rc != EXIT_SUCCESS)
+        return rc;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = writeMatrix(*(argv + optind + 2), &dict, threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (rc == EXIT_SUCCESS) {
+        double secs = (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("wrote %s: %d x %d patterns with %d thread%s in %.2fs\n",
+               *(argv + optind + 2), dict.size, dict.size, threads,
+               threads == 1 ? "" : "s", secs);
+    }
+    freeDict(&dict);
+    return rc;
+}
@@ -0,0 +1,101 @@
+/* hw3-stat.c */
+
+// Prints the latency histograms a running server publishes with -S (see
+// Latency.h), every few seconds, without getting in the server's way: the
+// segment is only ever read.
+// Build with: gcc -Wall -O2 hw3-stat.c -o hw3-stat.out
+// USAGE: hw3-stat.out [-c] [-i <seconds>] [-n <count>] <stats-name>
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Latency.h"
+
+#define DEFAULT_INTERVAL 1.0
+
+int usage(const char *prog) {
+    fprintf(stderr,
+            "ERROR: Invalid argument(s)\nUSAGE: %s [-c] [-i <seconds>] "
+            "[-n <count>] <stats-name>\n",
+            prog);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    double interval = DEFAULT_INTERVAL;
+    bool cumulative = false;
+    long count = 0; // 0 to keep going until the server goes away
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ci:n:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cumulative = true;
+            break;
+        case 'i':
+            if (sscanf(optarg, "%lf", &interval) != 1 || interval <= 0)
+                return usage(*argv);
+            break;
+        case 'n':
+            if (sscanf(optarg, "%ld", &count) != 1 || count < 1)
+                return usage(*argv);
+            break;
+        default:
+            return usage(*argv);
+        }
+    }
+    if (argc - optind != 1)
+        return usage(*argv);
+
+    const struct LatencySegment *seg = attachLatency(*(argv + optind));
+    if (seg == NULL) {
+        fprintf(stderr, "ERROR: no server is publishing latencies as %s\n",
+                *(argv + optind));
+        return EXIT_FAILURE;
+    }
+    pid_t pid = seg->header.pid;
+
+    // The counts as of the last report, so each one can show just what
+    // happened since.
+    static uint64_t last[NUM_LAT_STAGES][LATENCY_BUCKETS];
+    uint64_t counts[LATENCY_BUCKETS];
+    struct Histogram hist;
+
+    for (long reports = 0; count == 0 || reports < count; reports++) {
+        if (reports > 0 || !cumulative)
+            usleep(interval * 1e6);
+
+        time_t now = time(NULL);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&now));
+        printf("# %s server %d, %s, latency in microseconds\n", stamp, pid,
+               cumulative ? "since start" : "since last report");
+        for (int stage = 0; stage < NUM_LAT_STAGES; stage++) {
+            readLatency(seg, stage, counts);
+            if (!cumulative) {
+                for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                    uint64_t total = counts[b];
+                    counts[b] -= last[stage][b];
+                    last[stage][b] = total;
+                }
+            }
+            latencyHist(counts, &hist);
+            printHist(stdout, latencyStageName(stage), &hist, 1000);
+        }
+        fflush(stdout);
+
+        // The server removes the segment when it shuts down.
+        if (kill(pid, 0) == -1) {
+            printf("# server %d has stopped\n", pid);
+            break;
+        }
+    }
+
+    munmap((void *)seg, sizeof(struct LatencySegment));
+    return EXIT_SUCCESS;
+}
@@ -1,81 +1,669 @@
+// For pinning the acceptor threads to CPUs.
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "LinkedList.h"
+// Build with -DWORD_LEN=n to play n letter words instead of 5, for n from 4
+// to 8 (see Dictionary.h), and with -DUSE_IO_URING (and link with -luring)
+// for the io_uring server mode, which is left out if liburing is not
+// installed.
+#ifdef USE_IO_URING
+#if __has_include(<liburing.h>)
+#include <liburing.h>
+#define HAVE_IO_URING
+#else
+#warning "liburing.h not found, building without the io_uring server mode"
+#endif
+#endif
+
+#include "Dictionary.h"
+#include "Epoch.h"
+#include "Hint.h"
+#include "Journal.h"
+#include "Latency.h"
+#include "Log.h"
+#include "Matrix.h"
+#include "Protocol.h"
+#include "Registry.h"
+#include "RingQueue.h"
+#include "Rng.h"
+#include "Slab.h"
+#include "Stats.h"
+#include "Thread.h"
+#include "Ticket.h"
+#include "Upgrade.h"
+#include "WordLog.h"
+#include "Wordle.h"
 
 #define BUFFER_SIZE 257
+#define MAX_GUESSES 6
+#define DEFAULT_REACTORS 4
+#define DEFAULT_WORKERS 32
+#define DEFAULT_QUEUE_SIZE 64
+#define DEFAULT_BACKLOG SOMAXCONN
+#define MAX_ACCEPTORS UPGRADE_MAX_LISTENERS
+#define REACTOR_EVENTS 256
+// How much a connection can buffer, in every server mode: as many v2 frames
+// each way. A v1 connection fits a lot more guesses than replies,
+// and the guesses wait for room in the output to be played.
+#define CONN_FRAMES 32
+#define CONN_IN_SIZE (V2_MAX_FRAME * CONN_FRAMES)
+#define CONN_OUT_SIZE (V2_MAX_REPLY * CONN_FRAMES)
+// Once a batch has been played, what is left of a connection's input is
+// less than a whole guess or frame.
+#define CONN_PARTIAL_SIZE (V2_MAX_FRAME - 1)
+// How many connections' state the epoll and io_uring modes make room for up
+// front, unless -G says otherwise.
+#define DEFAULT_SLAB_GAMES 16384
+// 'Y' or 'N', guesses remaining as a network order short, the feedback, and
+// a null byte.
+#define REPLY_SIZE (4 + WORD_LEN)
+// Most games one v2 connection can have going at once.
+#define SESSION_GAMES 64
+#define URING_ENTRIES 4096
+// Receive buffers shared by every connection in the io_uring server mode.
+#define URING_BUFFERS 4096
+#define URING_BUFFER_SIZE 64
+#define URING_BGID 0
+// How often a server that has handed its listener over checks whether its
+// games have all finished.
+#define DRAIN_POLL_US 10000
+// How often an event loop that is shutting down looks for the hints it is
+// owed, should it be unable to wait for them.
+#define HINT_POLL_US 10000
+// What a pool worker's entry in worker_sd is once it has exited.
+#define WORKER_EXITED -2
+// How often the reloader checks whether the games on a replaced dictionary
+// have all finished.
+#define RECLAIM_POLL_US 10000
 
 extern int total_guesses;
 extern int total_wins;
 extern int total_losses;
 extern char **words;
-int words_size = 1;
 
 // I hate threads.
 sig_atomic_t server_shutdown = 0;
 sig_atomic_t signalled = 0;
-struct List *global_thread_list;
+sig_atomic_t upgrade_requested = 0;
+sig_atomic_t reload_requested = 0;
+// Each game's word is drawn from its own stream of this seed, numbered by
+// the order the connections were accepted in.
+uint64_t game_seed;
+atomic_ullong games_accepted = 0;
+// What the tickets of stateless games are sealed with, from getrandom() or
+// the key file (see Ticket.h).
+struct TicketKey ticket_key;
+char *ticket_key_fn = NULL;
+// What the check bits of journal tokens are drawn with, so they cannot be
+// worked out from the seed. Every server draws its own, since the bits are
+// kept in the journal.
+struct TicketKey token_key;
+// Everything games are played against: the word list and what is built
+// from it. A reload swaps a new copy in for the games that start after it,
+// and the games already going keep the copy they started with until they
+// end, when the last one out lets it be freed (see Epoch.h).
+struct GameData {
+    struct Dictionary dict;
+    // Every guess against every word, if the server was given a matrix file.
+    struct Matrix matrix;
+    struct HintEngine hints;
+    bool hints_on;
+    uint16_t ticket_dict; // the words' fingerprint, for tickets
+    struct Epoch games;   // the games played against this copy
+    struct GameData *next_retired;
+};
+_Atomic(struct GameData *) game_data = NULL;
+struct Epoch lookups; // games finding game_data
+// Where the game data is loaded from.
+char dictionary_fn[BUFFER_SIZE];
+int dict_size;
+char *matrix_fn = NULL;
+// Helper threads for the hint engine, or -1 with hints off. Hints are asked
+// for with V2_HINT, or by a v1 client with HINT_REQUEST as its guess.
+int hint_threads = -1;
+// Copies that have been swapped out but may still have games going. Only
+// the reloader touches these until it has been stopped.
+struct GameData *retired = NULL;
+pthread_t reloader;
+bool reloader_on = false;
+sem_t reload_sem;
+
+// Every word played so far. words is only filled in from it once the
+// server has stopped.
+struct WordLog word_log;
+// The journal of every game, if the server was given -j, and the games in
+// it that had not ended when the server started.
+char *journal_fn = NULL;
+struct Journal journal;
+bool journal_on = false;
+struct JournalRecovery recovered;
+// Guesses, wins and losses as they happen. They are copied into the
+// total_* globals once the server has stopped.
+struct Stats stats;
+// Where each stage's latencies go, if the server was given -S.
+struct LatencySegment *latency = NULL;
+char *latency_name = NULL;
+// Hot upgrades (see Upgrade.h). The server this one is handing over to, and
+// the one it took over from, until that one has sent its totals.
+char **server_argv;
+pid_t successor = -1;
+int successor_fd = -1;
+bool handed_over = false;
+pid_t predecessor = -1;
+int predecessor_fd = -1;
+pthread_t inherit_thread;
+struct UpgradeTotals inherited;
+char **inherited_words = NULL;
+atomic_bool inherited_ok = false;
+// Everything the server prints. Until it is started, and with -L sync, lines
+// are printed by the thread that logs them.
+struct Logger logger = {.level = LOG_DEBUG, .policy = LOG_SYNC};
+
+// The state of one game against one client, shared by every server mode.
+struct game {
+    uint32_t target; // dictionary position of the word
+    uint16_t guesses_remaining;
+    bool winner;
+    bool journaled; // stateless games never are
+    bool ticketed;  // a stateless game, which is not counted (see Ticket.h)
+    // Every valid guess so far and the pattern it got, for the hint engine.
+    uint32_t played[MAX_GUESSES];
+    pattern_code patterns[MAX_GUESSES];
+    struct GameData *data; // held from startGame() to endGame()
+    uint64_t token;        // in the journal
+};
+
+// A game is one cache line; the epoll and io_uring modes keep one in every
+// connection, idle or not.
+_Static_assert(sizeof(struct game) <= 64, "struct game grew past 64 bytes");
+
+// The games going on one v2 connection (see Protocol.h), by the name the
+// client gave them.
+struct session {
+    uint64_t seq;
+    uint32_t started; // games started so far, which picks each one's word
+    int live;
+    bool hung_up; // the client broke the protocol, nothing more is played
+    struct {
+        bool live;
+        uint32_t id;
+        struct game game;
+    } games[SESSION_GAMES];
+};
+
+// The buffers of a connection that has requests being played or replies
+// going out.
+struct conn_io {
+    char in[CONN_IN_SIZE]; // partial guesses or frames not yet played
+    int in_len;
+    char out[CONN_OUT_SIZE]; // replies the socket has not taken yet
+    int out_len;
+    int out_sent;
+};
+
+// Hints the hint engine's helpers have worked out for the connections of one
+// event loop, which they wake up through wakefd to answer them.
+struct hint_box {
+    pthread_mutex_t mutex; // guards done
+    struct conn_hint *done;
+    int wakefd;
+    int waiting; // hints asked for and not taken back yet, the loop's own
+};
+
+// A hint a connection asked the helpers for. The connection plays nothing
+// more until it is back.
+struct conn_hint {
+    struct HintRequest request;
+    struct conn *conn;
+    struct hint_box *box;
+    struct conn_hint *next;
+};
+
+// One client connection in the epoll and io_uring server modes. The game is
+// driven by whatever bytes arrive, so everything a game thread would keep on
+// its stack has to live here.
+// Which protocol the client speaks is only known once its first bytes are in;
+// until then version is 0.
+// A connection waiting on its client gives its buffers back and keeps the
+// part of a request it has so far in partial, so an idle game costs only
+// this struct.
+struct conn {
+    int sd;
+    int8_t version;
+    bool finished; // close once the output has gone out
+    bool closing; // its socket is on the way out
+    uint8_t partial_len;
+    uint64_t seq;
+    uint64_t accepted_at;
+    uint64_t received_at; // when the requests now being answered came in
+    struct game game;         // the v1 game
+    struct session *session; // or the v2 games
+    struct conn_io *io;      // or NULL while idle
+    struct conn_hint *hint;  // being worked out, or NULL
+    int pending_ops;         // io_uring requests the kernel still holds
+    char partial[CONN_PARTIAL_SIZE];
+    struct conn *prev;
+    struct conn *next;
+};
+
+// One event loop thread and the connections it owns, which come from its
+// slab of connections, as do their buffers.
+struct reactor {
+    pthread_t tid;
+    int epfd;
+    // eventfd used to wake the loop when the server shuts down, or a hint
+    // has been worked out
+    int wakefd;
+    pthread_mutex_t mutex; // guards conns and conn_slab
+    struct conn *conns;
+    struct Slab conn_slab;
+    struct Slab io_slab; // only the reactor's thread touches this
+    struct hint_box hints;
+};
 
-pthread_mutex_t mutex_words = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex_losses = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex_wins = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t *mutex_list;
-pthread_mutex_t mutex_guesses = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex_targs = PTHREAD_MUTEX_INITIALIZER;
+enum server_mode { MODE_THREADS, MODE_POOL, MODE_EPOLL, MODE_URING };
+
+enum server_mode mode = MODE_THREADS;
+
+// How replies go out on client sockets: as the kernel sees fit (Nagle's
+// algorithm), straight away (TCP_NODELAY), or held back while a batch is
+// written and pushed out once it all has been (TCP_CORK).
+enum send_mode { SEND_NAGLE, SEND_NODELAY, SEND_CORK };
+
+enum send_mode send_mode = SEND_NAGLE;
+// SO_RCVBUF and SO_SNDBUF for client sockets, or 0 for the kernel's default.
+int socket_buffer = 0;
+// How many connections the epoll and io_uring modes have room for at start.
+int slab_games = DEFAULT_SLAB_GAMES;
+struct reactor *reactors = NULL;
+int num_reactors = 0;
+atomic_uint next_reactor = 0;
+
+struct RingQueue *accept_queue = NULL;
+pthread_t *workers = NULL;
+atomic_int *worker_sd = NULL; // the connection each worker is playing, or -1
+int num_workers = 0;
+
+// The listening sockets: just the one, or with -a one SO_REUSEPORT socket
+// per acceptor thread, which accepts on it in place of the main thread.
+int listeners[MAX_ACCEPTORS];
+int num_listeners = 0;
+pthread_t acceptors[MAX_ACCEPTORS];
+int num_acceptors = 0;
+int acceptor_pipe[2] = {-1, -1}; // readable once the acceptors are to stop
+struct Registry *acceptor_clients = NULL;
+// Game threads go on any CPU, not just the one their acceptor is pinned to.
+pthread_attr_t game_thread_attr;
 
 struct args {
     int csd;
-    int dict_len;
-    char **dictionary;
-    struct List *thread_list;
+    uint64_t seq;
+    uint64_t accepted_at;
+    struct Registry *registry;
+    uint64_t conn_id;
 };
 
+#ifdef HAVE_IO_URING
+#define URING_USAGE "|uring"
+#else
+#define URING_USAGE ""
+#endif
+
+// Frees a copy of the game data and everything built from it.
+void freeGameData(struct GameData *data) {
+    if (data->hints_on)
+        stopHints(&data->hints);
+    unloadMatrix(&data->matrix);
+    freeDict(&data->dict);
+    free(data);
+}
+
+// Loads a new copy of the game data from the files the server was given.
+// Returns NULL on error.
+struct GameData *loadGameData() {
+    struct GameData *data =
+        aligned_alloc(_Alignof(struct GameData), sizeof(struct GameData));
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: aligned_alloc() failed\n");
+        return NULL;
+    }
+    memset(data, 0, sizeof(struct GameData));
+
+    FILE *dict_in = fopen(dictionary_fn, "r");
+    if (dict_in == NULL) {
+        perror("ERROR: open() failed");
+        free(data);
+        return NULL;
+    }
+
+    logText(&logger, "MAIN: opened %s (%d words)\n", dictionary_fn, dict_size);
+
+    // populate our dictionary
+    if (readDict(dict_in, &data->dict, dict_size) != 0) {
+        // readDict() frees whatever it allocated before failing.
+        fclose(dict_in);
+        free(data);
+        return NULL;
+    }
+
+    fclose(dict_in);
+    data->ticket_dict = ticketDict(&data->dict);
+
+    if (matrix_fn != NULL) {
+        if (!loadMatrix(matrix_fn, &data->dict, &data->matrix)) {
+            freeGameData(data);
+            return NULL;
+        }
+        logText(&logger, "MAIN: loaded feedback matrix %s\n", matrix_fn);
+    }
+
+    if (hint_threads >= 0) {
+        if (startHints(&data->hints, &data->dict, &data->matrix,
+                       hint_threads) != EXIT_SUCCESS) {
+            freeGameData(data);
+            return NULL;
+        }
+        data->hints_on = true;
+
+        char opening[WORD_LEN + 1] = NO_WORD_TEXT;
+        if (data->hints.opening != NO_WORD)
+            unpackWord(*(data->dict.words + data->hints.opening), opening);
+        logText(&logger,
+                "MAIN: hint engine ready (%s matrix, best opening guess %s)\n",
+                data->hints.codes != NULL ? "with" : "no", opening);
+    }
+
+#ifdef BAD_AT_THIS
+    logText(&logger, "MAIN: Successfully populated dictionary.\n");
+#endif
+    return data;
+}
+
+// Counts a new game in on the current copy of the game data, which it
+// keeps until releaseGameData().
+struct GameData *acquireGameData() {
+    enterEpoch(&lookups);
+    struct GameData *data = atomic_load(&game_data);
+    enterEpoch(&data->games);
+    leaveEpoch(&lookups);
+    return data;
+}
+
+void releaseGameData(struct GameData *data) {
+    leaveEpoch(&data->games);
+}
+
+// Loads a new copy of the game data and swaps it in, keeping the old one
+// on the retired list. Leaves the old one in place if the new one does not
+// load.
+void reloadGameData() {
+    struct GameData *fresh = loadGameData();
+    if (fresh == NULL) {
+        logText(&logger, "MAIN: reload failed; keeping the old dictionary\n");
+        return;
+    }
+    struct GameData *old = atomic_exchange(&game_data, fresh);
+    old->next_retired = retired;
+    retired = old;
+    logText(&logger, "MAIN: reloaded dictionary (%d words)\n",
+            fresh->dict.size);
+}
+
+// Frees every retired copy that has no games left.
+void reclaimGameData() {
+    // Nobody can be about to count into a retired copy once the lookups
+    // have been quiet after it was swapped out.
+    if (!quietEpoch(&lookups))
+        return;
+    struct GameData **link = &retired;
+    while (*link != NULL) {
+        struct GameData *data = *link;
+        if (quietEpoch(&data->games)) {
+            *link = data->next_retired;
+            freeGameData(data);
+        } else {
+            link = &data->next_retired;
+        }
+    }
+}
+
+// Reloads the game data every time reload_sem is posted, and frees the old
+// copies as their games finish, until the server shuts down.
+void *reloadLoop(void *arg) {
+    (void)arg;
+    struct timespec until;
+    int rc;
+
+    while (!server_shutdown) {
+        // Only wakes up by itself while there are copies waiting to go.
+        if (retired == NULL) {
+            rc = sem_wait(&reload_sem);
+        } else {
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += RECLAIM_POLL_US * 1000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            rc = sem_timedwait(&reload_sem, &until);
+        }
+        if (rc == 0 && !server_shutdown)
+            reloadGameData();
+        reclaimGameData();
+    }
+    return NULL;
+}
+
+// Starts the thread that reloads the game data on SIGHUP.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int startReloader() {
+    sem_init(&reload_sem, 0, 0);
+    int rc = spawnHelper(&reloader, reloadLoop, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n", rc);
+        sem_destroy(&reload_sem);
+        return EXIT_FAILURE;
+    }
+    reloader_on = true;
+    return EXIT_SUCCESS;
+}
+
+// Stops the reloader, once server_shutdown is set, and frees every copy of
+// the game data. Nothing may be playing a game any more.
+void stopReloader() {
+    if (reloader_on) {
+        sem_post(&reload_sem);
+        pthread_join(reloader, NULL);
+        sem_destroy(&reload_sem);
+        reloader_on = false;
+    }
+    while (retired != NULL) {
+        struct GameData *data = retired;
+        retired = data->next_retired;
+        freeGameData(data);
+    }
+    struct GameData *data = atomic_exchange(&game_data, NULL);
+    if (data != NULL)
+        freeGameData(data);
+}
+
 int badInput() {
     fprintf(stderr,
-            "ERROR: Invalid argument(s)\nUSAGE: hw3.out <listener-port> <seed> "
-            "<dictionary-filename> <num-words>\n");
+            "ERROR: Invalid argument(s)\nUSAGE: hw3.out [-a <acceptors>] "
+            "[-b <backlog>] [-B <socket-buffer-bytes>] [-G <games>] "
+            "[-H <hint-threads>] [-j <journal-file>] [-K <ticket-key-file>] "
+            "[-l off|info|debug] [-L sync|block|drop] "
+            "[-m threads|pool|epoll" URING_USAGE "] [-n <threads>] "
+            "[-p <matrix-file>] [-q <queue-size>] [-S <stats-name>] "
+            "[-T nagle|nodelay|cork] "
+            "[-w <word-log-file>] "
+            "<listener-port> <seed> <dictionary-filename> <num-words>\n"
+            "With -H, a v1 client can send " HINT_REQUEST " in place of a "
+            "guess. The reply is 'H',\nthe guesses left and the suggested "
+            "word, and no guess is used up.\n");
     return EXIT_FAILURE;
 }
 
+void stopReactors();
+void stopPool();
+void stopAcceptors();
+
+void wakeClient(int csd, void *arg) {
+    (void)arg;
+    shutdown(csd, SHUT_RD);
+}
+
+// Reads the totals of the server this one took over from, once it has
+// finished its games.
+void *inheritTotals(void *arg) {
+    (void)arg;
+    bool ok = receiveTotals(predecessor_fd, &inherited, &inherited_words);
+    atomic_store(&inherited_ok, ok);
+    return NULL;
+}
+
+// Returns first followed by second, two NULL terminated lists of words,
+// which are freed (but not the words in them). Returns first if there is
+// not enough memory for both.
+char **joinWords(char **first, char **second) {
+    size_t n = 0;
+    size_t m = 0;
+    if (first == NULL)
+        return second;
+    if (second == NULL)
+        return first;
+    while (*(first + n) != NULL)
+        n++;
+    while (*(second + m) != NULL)
+        m++;
+    char **both = realloc(first, (n + m + 1) * sizeof(char *));
+    if (both == NULL) {
+        fprintf(stderr, "ERROR: realloc() failed\n");
+        for (size_t i = 0; i < m; i++)
+            free(*(second + i));
+        free(second);
+        return first;
+    }
+    memcpy(both + n, second, (m + 1) * sizeof(char *));
+    free(second);
+    return both;
+}
+
+// Writes out and closes the journal, if there is one. Nothing may be playing
+// a game any more.
+void closeGameJournal() {
+    if (!journal_on)
+        return;
+    closeJournal(&journal);
+    freeJournalRecovery(&recovered);
+    journal_on = false;
+}
+
 // This is called if the server encounters an error and would otherwise shut
 // down. Cleans up all dynamic memory allocated before the server goes live.
-void cleanupServer(char **dictionary, int dictsz, struct args *thread_arguments,
-                   struct List *thread_list) {
+void cleanupServer(struct Registry *clients) {
     // This function is only called from main, so
     //  First we wait for all thread activity to stop
+    bool told_to_stop = signalled;
     server_shutdown = 1;
     signalled = 1;
-    int running = -1;
 
-    do {
-        pthread_mutex_lock(mutex_list);
-        { running = thread_list->size; }
-        pthread_mutex_unlock(mutex_list);
-    } while (running != 0);
+    // The acceptors go first, since they hand connections to the rest. One
+    // waiting for room in the pool's queue gives up once the queue closes.
+    if (num_acceptors > 0) {
+        if (accept_queue != NULL)
+            closeRing(accept_queue, num_workers);
+        stopAcceptors();
+    }
+    if (reactors != NULL)
+        stopReactors();
+    if (workers != NULL)
+        stopPool();
+
+    // Same as the pool workers, game threads waiting on a quiet client are
+    // woken up by shutting down the reading side of their socket.
+    walkRegistry(clients, wakeClient, NULL);
+    while (sizeRegistry(clients) != 0)
+        ;
+    closeGameJournal();
+
+    // Nothing is logging any more either.
+    stopLogger(&logger);
+
+    // Every game has finished counting by now, so the totals are exact.
+    total_guesses = readStat(&stats, STAT_GUESSES);
+    total_wins = readStat(&stats, STAT_WINS);
+    total_losses = readStat(&stats, STAT_LOSSES);
+
+    char **played = viewWordLog(&word_log);
+    if (played != NULL) {
+        free(words);
+        words = played;
+    }
+    freeWordLog(&word_log);
+
+    // A server that took over from another counts that one's games too,
+    // which come first. If this one was told to stop, so is the old one,
+    // otherwise it is waited for.
+    if (predecessor_fd != -1) {
+        if (told_to_stop && !atomic_load(&inherited_ok))
+            kill(predecessor, SIGUSR1);
+        pthread_join(inherit_thread, NULL);
+        close(predecessor_fd);
+        predecessor_fd = -1;
+        if (atomic_load(&inherited_ok)) {
+            total_guesses += inherited.guesses;
+            total_wins += inherited.wins;
+            total_losses += inherited.losses;
+            words = joinWords(inherited_words, words);
+        }
+    }
+    // And one that handed over passes everything on the same way. A new
+    // server still waiting for the listener gives up once this end closes.
+    if (successor_fd != -1) {
+        if (handed_over && !sendTotals(successor_fd, total_guesses,
+                                       total_wins, total_losses, words))
+            perror("ERROR: sending the totals to the new server failed");
+        close(successor_fd);
+        successor_fd = -1;
+        if (!handed_over)
+            waitpid(successor, NULL, 0);
+    }
 
     // Now that we know no threads are using this memory,
     //  we can free it up.
-    for (int i = 0; i < dictsz; i++) {
-        free(*(dictionary + i));
-    }
-
-    free(dictionary);
-    free(thread_arguments);
-    free(thread_list);
+    stopReloader();
+    freeRegistry(clients);
+    if (latency != NULL)
+        closeLatency(latency, latency_name);
+    latency = NULL;
 }
 
-// Only called if the server recieves SIGUSR1
+// Only called if the server recieves SIGUSR1, or SIGUSR2 for a hot upgrade,
+// or SIGHUP to reload the dictionary.
 // In theory this ensures that there are no running threads once this
 //  handler returns.
 void killServer(int sig) {
@@ -83,6 +671,10 @@ void killServer(int sig) {
     if (sig == SIGUSR1) {
         server_shutdown = 1;
         signalled = 1;
+    } else if (sig == SIGUSR2) {
+        upgrade_requested = 1;
+    } else if (sig == SIGHUP) {
+        reload_requested = 1;
     }
 }
 
@@ -107,488 +699,2152 @@ char *strupper(char *str, char *o) {
 //  according to the wordle algorithm. Returns a string in result where correct
 //  letter in correct position is capitalized, correct letter in the wrong
 //  position is lowercase in the guess position, and wrong letter is just a '-'
-// Expects that all 3 arguments are character strings of length 5 (not including
-//  null terminator)
-// If either wordle or guess point to the same heap memory as result, the state
-//  of all 3 strings after the call is undefined.
+// Expects that wordle and guess are lowercase words of length WORD_LEN (not
+//  including null terminator), and that result has room for WORD_LEN
+//  characters.
+// The scoring itself lives in Wordle.h, and works without touching the heap.
 void evaluateWordleGuess(const char *wordle, const char *guess, char *result) {
     if (wordle == NULL || guess == NULL || result == NULL) {
         fprintf(stderr, "wordle() failed: NULL pointer arguments\n");
         return;
     }
 
-    int i, j;
-    bool *wordleUsed = calloc(5, sizeof(bool));
-    bool *guessUsed = calloc(5, sizeof(bool));
-
-    // Correct letter in correct position
-    for (i = 0; i < 5; i++) {
-        if (*(wordle + i) == *(guess + i)) {
-            *(result + i) = toupper(*(guess + i));
-            *(wordleUsed + i) = true;
-            *(guessUsed + i) = true;
-        }
-    }
-
-    // Check for yellow feedback
-    for (i = 0; i < 5; i++) {
-        if (!*(guessUsed + i)) {
-            for (j = 0; j < 5; j++) {
-                if (!*(wordleUsed + j) && *(wordle + j) == *(guess + i)) {
-                    *(result + i) = *(guess + i);
-                    *(wordleUsed + j) = true;
-                    *(guessUsed + i) = true;
-                    break;
-                }
-            }
-        }
-    }
-
-    // Mark the rest as gray
-    for (i = 0; i < 5; i++) {
-        if (!*(guessUsed + i)) {
-            *(result + i) = '-';
-        }
+    word_key target = packWord(wordle);
+    word_key attempt = packWord(guess);
+    if (target == NO_KEY || attempt == NO_KEY) {
+        fprintf(stderr, "wordle() failed: arguments are not %d letter words\n",
+                WORD_LEN);
+        return;
     }
 
-    free(wordleUsed);
-    free(guessUsed);
+    patternToResult(scoreGuess(target, attempt), guess, result);
 }
 
-// This function just parses the dictionary file.
-// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
-int readDict(FILE *dict_in, char **dict, int dict_size) {
-    char *word_buffer = (char *)calloc(BUFFER_SIZE, sizeof(char));
-
-    for (int i = 0; i < dict_size; i++) {
-        int numread = fscanf(dict_in, "%s", word_buffer);
-        if (numread == 0) {
-            fprintf(stderr, "ERROR: Failed to read before EOF\n");
-            return EXIT_FAILURE;
-        }
-        if (numread == EOF) {
-            perror("ERROR: fscanf() failed");
-            return EXIT_FAILURE;
-        }
-        // All words in the dictionary should only be this long...
-        *(dict + i) = calloc(6, sizeof(char));
-        if (*(dict + i) == NULL) {
-            fprintf(stderr, "ERROR: calloc() failed\n");
-            return EXIT_FAILURE;
-        }
-
-        strcpy(*(dict + i), word_buffer);
-        // case is irrelevant, so lower everything.
-        strlower(*(dict + i));
+// Starts a new game against a random word from the current dictionary, and
+// adds that word to the global list of words played.
+// Returns false if the word could not be recorded, in which case the server
+// has been told to shut down.
+// Picks the word for game number seq from stream seq of the seed, which is
+// left in rng, and counts it as played.
+// Returns false if the server is shutting down, and the game is not started.
+bool pickWord(struct game *game, uint64_t seq, struct Rng *rng) {
+    struct GameData *data = acquireGameData();
+    struct Dictionary *dict = &data->dict;
+    game->data = data;
 
-        // Better than worrying about leftover data...
-        memset(word_buffer, 0, strlen(word_buffer));
-    }
-
-    // this is only needed for dictionary population
-    free(word_buffer);
-    return EXIT_SUCCESS;
-}
-
-void *do_on_thread(void *arguments) {
-    // This conversion is implicit but im putting it here anyway
-    struct args *thread_args = (struct args *)arguments;
-    int csd = thread_args->csd;
-    char **dict = thread_args->dictionary;
-    int dict_sz = thread_args->dict_len;
-    char **tmp_words, *tmp;
-    struct List *running_threads = thread_args->thread_list;
     // which word from the dictionary is our game played against?
-    int dict_index = rand() % dict_sz;
-
-    // May as well check before we start allocating things
-    if (server_shutdown) {
-        if (signalled)
-            printf("MAIN: SIGUSR1 rcvd; Wordle server shutting down...\n");
-        pthread_exit(NULL);
-    }
-
-    char *wordle = calloc(6, sizeof(char));
-    if (wordle == NULL) {
-        fprintf(stderr, "THREAD %lu: ERROR: failed to allocate wordle",
-                pthread_self());
-
-        removeList(running_threads, pthread_self());
-        pthread_exit(NULL);
-    }
-
-    strcpy(wordle, *(dict + dict_index));
+    seedRng(rng, game_seed, seq);
+    uint32_t dict_index = boundedRng(rng, dict->size);
+    game->target = dict_index;
+
+    game->guesses_remaining = MAX_GUESSES;
+    game->winner = false;
+    game->journaled = false;
+    game->ticketed = false;
 #ifdef BAD_AT_THIS
-    printf("THREAD %lu: wordle is: %s\n", pthread_self(), wordle);
+    char wordle[WORD_LEN + 1];
+    unpackWord(*(dict->words + dict_index), wordle);
+    logEvent(&logger, LOG_WORDLE, wordle, 0);
 #endif
     // We have our word, we can now add it to the global set of words used.
-    pthread_mutex_lock(&mutex_words);
-    {
-        tmp = calloc(6, sizeof(char));
-        tmp_words = realloc(words, sizeof(char *) * (words_size + 1));
-        if (tmp_words != NULL) {
-            *(tmp_words + words_size - 1) = calloc(1, sizeof(char *));
-            strcpy(*(tmp_words + words_size - 1), strupper(wordle, tmp));
-            *(tmp_words + words_size) = NULL;
-            words_size++;
-            words = tmp_words;
-        } else {
+    if (!appendWordLog(&word_log, *(dict->words + dict_index)))
+        server_shutdown = 1;
+    // The game is not played, so endGame() is not called either.
+    if (server_shutdown)
+        releaseGameData(data);
+    return !server_shutdown;
+}
+
+// Starts game number seq (see pickWord()). resumable is false if the client
+// will never be told the game's token; only v2 clients are.
+// Returns false if the server is shutting down, and the game is not started.
+bool startGame(struct game *game, uint64_t seq, bool resumable) {
+    struct Rng rng;
+    if (!pickWord(game, seq, &rng))
+        return false;
+    if (journal_on) {
+        game->token =
+            journalStart(&journal, *(game->data->dict.words + game->target),
+                         sipHash(token_key.k0, token_key.k1, seq) >> 32,
+                         resumable);
+        if (game->token == JOURNAL_NO_TOKEN) {
             server_shutdown = 1;
+            releaseGameData(game->data);
+            return false;
         }
+        game->journaled = true;
     }
-    pthread_mutex_unlock(&mutex_words);
-    free(tmp);
-    // Checking this variable after every mutex, this is a better alternative to
-    // signals, since I dont need to worry about whether a thread currently
-    // holds a mutex
-    if (server_shutdown) {
-        if (signalled)
-            printf("MAIN: SIGUSR1 rcvd; Wordle server shutting down...\n");
-        free(wordle);
+    return true;
+}
 
-        removeList(running_threads, pthread_self());
-        pthread_exit(NULL);
-    }
+// Whether the len bytes of guess ask game for a hint.
+bool askedHint(struct game *game, const char *guess, int len) {
+    return game->data->hints_on && len == WORD_LEN &&
+           memcmp(guess, HINT_REQUEST, WORD_LEN) == 0;
+}
 
-    uint16_t guesses_remaining = 6;
+// Whether a hint for game has to be worked out, rather than being one the
+// hint engine already knows.
+bool hintWaits(struct game *game) {
+    uint32_t hint;
+    return !knownHint(&game->data->hints, game->played, game->patterns,
+                      MAX_GUESSES - game->guesses_remaining, &hint);
+}
 
-    int bytes_sent;
-    int bytes_recieved;
+// Writes the reply to a hint request into reply, suggesting the dictionary
+// word at hint (or nothing, for NO_WORD). The reply looks like the one for a
+// valid guess, but starts with 'H' and carries the suggested word, and the
+// request does not use up a guess.
+void putHint(struct game *game, uint32_t hint, char *reply) {
+    char word[WORD_LEN + 1] = NO_WORD_TEXT;
+    short net_short;
+    if (hint != NO_WORD)
+        unpackWord(*(game->data->dict.words + hint), word);
 
-    // Because TCP is a stream protocol.
-    char buff_buffer;
+    logEvent(&logger, LOG_HINT, word, game->guesses_remaining);
 
-    char *recv_buffer = calloc(6, sizeof(char));
-    if (recv_buffer == NULL) {
-        fprintf(stderr, "THREAD %lu: ERROR: calloc() on recv_buffer failed\n",
-                pthread_self());
+    *reply = 'H';
+    net_short = htons(game->guesses_remaining);
+    memcpy(reply + 1, &net_short, sizeof(short));
+    memcpy(reply + 3, word, WORD_LEN);
+    *(reply + REPLY_SIZE - 1) = '\0';
+}
 
-        free(wordle);
+// Answers a hint request with the hint engine's pick for the next guess.
+void playHint(struct game *game, char *reply) {
+    putHint(game,
+            suggestGuess(&game->data->hints, game->played, game->patterns,
+                         MAX_GUESSES - game->guesses_remaining),
+            reply);
+}
 
-        removeList(running_threads, pthread_self());
-        pthread_exit(NULL);
-    }
-    char *send_buffer = calloc(9, sizeof(char));
-    if (send_buffer == NULL) {
-        fprintf(stderr, "THREAD %lu: ERROR: calloc() on send_buffer failed\n",
-                pthread_self());
+// Plays one guess from the client. guess is the null terminated text
+// received, and complete is false if it did not arrive as exactly WORD_LEN
+// bytes, which makes it invalid no matter what it says.
+// Fills reply with the REPLY_SIZE byte response to send back to the client.
+void playGuess(struct game *game, char *guess, bool complete, char *reply) {
+    struct Dictionary *dict = &game->data->dict;
+    struct Matrix *matrix = &game->data->matrix;
+    short net_short;
+    uint32_t guess_index = NO_WORD;
+    strlower(guess);
 
-        free(wordle);
-        free(recv_buffer);
+    logEvent(&logger, LOG_GUESS, guess, 0);
 
-        removeList(running_threads, pthread_self());
-        pthread_exit(NULL);
+    if (game->data->hints_on && complete &&
+        strcmp(guess, HINT_REQUEST) == 0) {
+        playHint(game, reply);
+        return;
     }
 
-    // For guess validation
-    bool valid, winner = false;
-
-    short net_short;
-    char *invalid = "?????";
-    int rc;
-    fd_set read_fd;
-    while (guesses_remaining > 0 && !winner && !server_shutdown) {
-        // First thing we are doing is checking if we have been told to stop.
-        // So when the server shuts down, it will finish what it is doing
-        //  and then stop before it would have accepted new input.
-
-        printf("THREAD %lu: waiting for guess\n", pthread_self());
-        // Setup select() so we block BEFORE the read call...
-        FD_ZERO(&read_fd);
-        FD_SET(csd, &read_fd);
-
-        rc = select(FD_SETSIZE, &read_fd, NULL, NULL, NULL);
-        if (rc == -1) {
-            if (errno != EINTR) {
-                perror("ERROR: select() failed");
-            }
-            free(wordle);
-            free(recv_buffer);
-            free(send_buffer);
+    // check if our guess is in the dictionary
+    // We can skip this if we recieved an incorrect number of bytes
+    // Since the guess is automatically invalid.
+    if (complete) {
+        uint64_t start = latencyClock(latency);
+        guess_index = lookupWord(dict, guess);
+        recordSince(latency, LAT_LOOKUP, start);
+    }
+    if (guess_index == NO_WORD) {
+        // Send an invalid guess response
+        logEvent(&logger, LOG_INVALID, NO_WORD_TEXT, game->guesses_remaining);
+
+        *reply = 'N';
+        net_short = htons(game->guesses_remaining);
+        memcpy(reply + 1, &net_short, sizeof(short));
+        memcpy(reply + 3, NO_WORD_TEXT, WORD_LEN);
+        *(reply + REPLY_SIZE - 1) = '\0';
+        return;
+    }
 
-            removeList(running_threads, pthread_self());
-            pthread_exit(NULL);
-        }
-        if (server_shutdown) {
-            break;
-        }
-        bytes_recieved = recv(csd, recv_buffer, 6, 0);
+    if (!game->ticketed)
+        countStat(&stats, STAT_GUESSES);
+
+    pattern_code code =
+        matrix->codes != NULL
+            ? lookupPattern(matrix, game->target, guess_index)
+            : scoreGuess(*(dict->words + game->target),
+                         *(dict->words + guess_index));
+    int played = MAX_GUESSES - game->guesses_remaining;
+    game->played[played] = guess_index;
+    game->patterns[played] = code;
+    --game->guesses_remaining;
+    if (game->journaled && !journalGuess(&journal, game->token,
+                                         *(dict->words + guess_index), code))
+        server_shutdown = 1;
 
-        if (bytes_recieved == -1) {
-            perror("ERROR: recv() failed");
+    if (code == PATTERN_SOLVED) {
+        game->winner = true;
+    }
 
-            free(wordle);
-            free(recv_buffer);
-            free(send_buffer);
+    // Ensure the buffer is in the same state for every guess.
+    memset(reply, 0, REPLY_SIZE);
+    patternToResult(code, guess, reply + 3);
 
-            removeList(running_threads, pthread_self());
-            pthread_exit(NULL);
+    *reply = 'Y';
+    net_short = htons(game->guesses_remaining);
+    memcpy(reply + 1, &net_short, sizeof(short));
 
-        } else if (bytes_recieved == 0) { // client disconnected. mark a loss
-                                          // and kill the connection
-            printf("THREAD %lu: client gave up; closing TCP connection...\n",
-                   pthread_self());
+#ifdef BAD_AT_THIS
+    logBytes(&logger, LOG_SEND_BUFFER, reply, REPLY_SIZE, 0);
+#endif
 
-            // Going to do some shenanigans to make this print work
-            for (int i = 0; i < strlen(wordle); i++) {
-                *(wordle + i) = toupper(*(wordle + i));
-            }
-            printf("THREAD %lu: game over; word was %s!\n", pthread_self(),
-                   wordle);
-
-            pthread_mutex_lock(&mutex_losses);
-            { total_losses++; }
-            pthread_mutex_unlock(&mutex_losses);
-
-            free(wordle);
-            free(recv_buffer);
-            free(send_buffer);
-
-            removeList(running_threads, pthread_self());
-            pthread_exit(NULL);
-        } else if (bytes_recieved < 5) {
-            // Wait for the remaining number of bytes.......
-            while (strlen(recv_buffer) < 5) {
-                if (recv(csd, &buff_buffer, 1, 0) == -1) {
-                    perror("ERROR: recv() failed");
-
-                    free(wordle);
-                    free(recv_buffer);
-                    free(send_buffer);
-
-                    removeList(running_threads, pthread_self());
-                    pthread_exit(NULL);
-                }
+    logEvent(&logger, LOG_REPLY, reply + 3, game->guesses_remaining);
+}
 
-                strncat(recv_buffer, &buff_buffer, 1);
-                *(recv_buffer + 5) = '\0';
-            }
-        }
+bool gameOver(struct game *game) {
+    return game->winner || game->guesses_remaining == 0;
+}
 
-        // I know how long the string is at this point
-        *(recv_buffer + 5) = '\0';
+// Records the result of a finished (or abandoned) game.
+void endGame(struct game *game) {
+    char wordle[WORD_LEN + 1];
+    char word[WORD_LEN + 1];
 
-        strlower(recv_buffer);
+    if (!game->ticketed)
+        countStat(&stats, game->winner ? STAT_WINS : STAT_LOSSES);
+    if (game->journaled && !journalEnd(&journal, game->token, game->winner))
+        server_shutdown = 1;
+    unpackWord(*(game->data->dict.words + game->target), wordle);
+    logEvent(&logger, LOG_GAME_OVER, strupper(wordle, word), 0);
+    releaseGameData(game->data);
+}
 
-        printf("THREAD %lu: rcvd guess: %s\n", pthread_self(), recv_buffer);
+// Lets go of a game its client is done with, one way or another. Unless the
+// server is shutting down it is recorded with endGame(); if it is, nothing is
+// counted, and the journal keeps the game to be resumed.
+void leaveGame(struct game *game) {
+    if (server_shutdown)
+        releaseGameData(game->data);
+    else
+        endGame(game);
+}
 
-        // check if our guess is in the dictionary
-        // We can skip this if we recieved an incorrect number of bytes
-        // Since the guess is automatically invalid.
-        valid = false;
+// Takes a game the journal has no end for back up, against the current
+// dictionary.
+// Returns false if there is no such game to take, or its words are not in
+// the dictionary any more.
+bool resumeGame(struct game *game, uint64_t token) {
+    struct JournalGame *saved =
+        journal_on ? takeJournalGame(&recovered, token) : NULL;
+    if (saved == NULL)
+        return false;
+
+    struct GameData *data = acquireGameData();
+    game->target = lookupKey(&data->dict.index, saved->target);
+    bool found = game->target != NO_WORD;
+    for (int i = 0; i < saved->guesses && found; i++) {
+        game->played[i] = lookupKey(&data->dict.index, *(saved->played + i));
+        game->patterns[i] = *(saved->patterns + i);
+        found = game->played[i] != NO_WORD;
+    }
+    if (!found) {
+        releaseGameData(data);
+        returnJournalGame(saved);
+        return false;
+    }
+    game->data = data;
+    game->token = token;
+    game->journaled = true;
+    game->ticketed = false;
+    game->guesses_remaining = MAX_GUESSES - saved->guesses;
+    game->winner = false;
+    return true;
+}
 
-        if (bytes_recieved == 5) {
-            for (int i = 0; i < dict_sz; i++) {
-                if (strcmp(*(dict + i), recv_buffer) == 0) {
-                    valid = true;
-                    break;
-                }
-            }
+// Plays every complete guess in in, as long as the game is still going and
+// out (out_size bytes, out_len of them used) has room for the reply.
+// Guesses are whatever WORD_LEN bytes come next, however the client's bytes
+// were split up on the way. Whatever is left over stays at the front of in.
+// Unless wait_hints is set, a hint that has to be worked out stops it, and
+// is left at the front of in too.
+// Returns the game if it stopped at such a hint, and NULL otherwise.
+struct game *playGuesses(struct game *game, char *in, int *in_len, char *out,
+                         int *out_len, int out_size, bool wait_hints) {
+    char guess[WORD_LEN + 1];
+    int used = 0;
+    struct game *waiting = NULL;
+
+    while (*in_len - used >= WORD_LEN && !gameOver(game) &&
+           *out_len + REPLY_SIZE <= out_size) {
+        if (!wait_hints && askedHint(game, in + used, WORD_LEN) &&
+            hintWaits(game)) {
+            waiting = game;
+            break;
         }
+        memcpy(guess, in + used, WORD_LEN);
+        guess[WORD_LEN] = '\0';
+        used += WORD_LEN;
+
+        playGuess(game, guess, true, out + *out_len);
+        *out_len += REPLY_SIZE;
+        if (!gameOver(game))
+            logEvent(&logger, LOG_WAITING, NULL, 0);
+    }
+    memmove(in, in + used, *in_len - used);
+    *in_len -= used;
+    return waiting;
+}
 
-        if (!valid) {
-            // Send an invalid guess response
-            printf("THREAD %lu: invalid guess; sending reply: ????? (%hd "
-                   "guess%s left)\n",
-                   pthread_self(), guesses_remaining,
-                   (guesses_remaining == 1 ? "" : "es"));
-
-            memset(send_buffer, 'N', sizeof(char));
-            net_short = htons(guesses_remaining);
-            memcpy(send_buffer + 1, &net_short, sizeof(short));
-            strcpy(send_buffer + 3, invalid);
-            bytes_sent = send(csd, send_buffer, 9, 0);
-
-            if (bytes_sent == -1) {
-                perror("ERROR: send() failed");
-
-                free(wordle);
-                free(recv_buffer);
-                free(send_buffer);
+// Protocol v2 (see Protocol.h).
+// Every frame is played against the session's game table and answered with
+// one frame, so the same code runs the games whether the connection is
+// served by its own thread, a pool worker, or an event loop.
 
-                removeList(running_threads, pthread_self());
+// Writes a V2_ERROR frame into out. Returns its size.
+int putError(char *out, uint32_t game, enum v2_error code) {
+    uint8_t byte = code;
+    return putFrame(out, V2_ERROR, game, &byte, 1);
+}
 
-                pthread_exit(NULL);
-            }
+// Returns the slot of the game the client named id, or -1 if it has none.
+int findGame(struct session *s, uint32_t id) {
+    for (int i = 0; i < SESSION_GAMES; i++) {
+        if (s->games[i].live && s->games[i].id == id)
+            return i;
+    }
+    return -1;
+}
 
-            continue;
-        }
+// Takes a finished game out of the session's table.
+void dropGame(struct session *s, int slot) {
+    endGame(&s->games[slot].game);
+    s->games[slot].live = false;
+    s->live--;
+}
 
-        pthread_mutex_lock(&mutex_guesses);
-        { total_guesses++; }
-        pthread_mutex_unlock(&mutex_guesses);
+// Writes the V2_STARTED frame for a game that has just started, or been
+// resumed, into out. Returns its size.
+int putStarted(char *out, uint32_t id, struct game *game) {
+    char payload[V2_STARTED_SIZE];
+    short net_short = htons(game->guesses_remaining);
+    uint64_t net_token = htobe64(game->token);
+
+    memcpy(payload, &net_short, sizeof(short));
+    memcpy(payload + sizeof(short), &net_token, V2_TOKEN_SIZE);
+    return putFrame(out, V2_STARTED, id, payload,
+                    journal_on ? V2_STARTED_SIZE : sizeof(short));
+}
 
-        --guesses_remaining;
+// Starts a stateless game (see Ticket.h) and writes its V2_TICKETED frame
+// into out. The word is counted as played, and that is all that is kept.
+// Returns the size of the reply.
+int startTicket(struct session *s, uint32_t id, char *out) {
+    char payload[V2_TICKETED_SIZE];
+    short net_short = htons(MAX_GUESSES);
+    struct Ticket ticket;
+    struct game game;
+    struct Rng rng;
+
+    // Numbered the same as the connection's other games.
+    if (!pickWord(&game, s->seq + ((uint64_t)s->started++ << 32), &rng)) {
+        s->hung_up = true;
+        return putError(out, id, V2_ERR_SHUTDOWN);
+    }
+    ticket.target = game.target;
+    ticket.guesses = MAX_GUESSES;
+    ticket.dict = game.data->ticket_dict;
+    ticket.nonce = nextRng(&rng) >> (64 - TICKET_NONCE_BITS);
+    releaseGameData(game.data);
+    memcpy(payload, &net_short, sizeof(short));
+    sealTicket(&ticket_key, &ticket, payload + sizeof(short));
+    return putFrame(out, V2_TICKETED, id, payload, V2_TICKETED_SIZE);
+}
 
-        // Ensure the buffer is in the same state for every iteration.
-        memset(send_buffer, 0, 9);
+// Plays the guess in a V2_PLAY frame against the game in its ticket, and
+// writes the reply into out: the result, and the game's next ticket unless
+// that was the end of it.
+// Returns the size of the reply.
+int playTicket(struct Frame *frame, char *out) {
+    char guess[WORD_LEN + 1];
+    char reply[REPLY_SIZE];
+    char payload[V2_RESULT_SIZE + TICKET_SIZE];
+    struct Ticket ticket;
+    struct game game;
+    int len = frame->payload_len - TICKET_SIZE;
+
+    if (len < 0 || !openTicket(&ticket_key, frame->payload, &ticket) ||
+        ticket.guesses == 0 || ticket.guesses > MAX_GUESSES)
+        return putError(out, frame->game, V2_ERR_TICKET);
+    if (len > WORD_LEN)
+        len = WORD_LEN;
+    memcpy(guess, frame->payload + TICKET_SIZE, len);
+    guess[len] = '\0';
+
+    game.data = acquireGameData();
+    // A ticket from before a reload that changed the words is no good, and
+    // may be past the end of them.
+    if (ticket.dict != game.data->ticket_dict ||
+        ticket.target >= (uint32_t)game.data->dict.size) {
+        releaseGameData(game.data);
+        return putError(out, frame->game, V2_ERR_TICKET);
+    }
+    // Hints go by the guesses played so far, which the ticket does not have.
+    if (game.data->hints_on && strcmp(guess, HINT_REQUEST) == 0) {
+        releaseGameData(game.data);
+        return putError(out, frame->game, V2_ERR_TYPE);
+    }
+    game.target = ticket.target;
+    game.guesses_remaining = ticket.guesses;
+    game.winner = false;
+    game.journaled = false;
+    game.ticketed = true;
+    playGuess(&game, guess, frame->payload_len == TICKET_SIZE + WORD_LEN,
+              reply);
+
+    memcpy(payload, reply + 1, V2_RESULT_SIZE);
+    if (gameOver(&game)) {
+        endGame(&game);
+        return putFrame(out, *reply, frame->game, payload, V2_RESULT_SIZE);
+    }
+    releaseGameData(game.data);
+    ticket.guesses = game.guesses_remaining;
+    sealTicket(&ticket_key, &ticket, payload + V2_RESULT_SIZE);
+    return putFrame(out, *reply, frame->game, payload, sizeof(payload));
+}
 
-        if (strcmp(wordle, recv_buffer) == 0) {
-            winner = true;
+// Plays one request and writes the reply frame into out, which needs room
+// for V2_MAX_REPLY bytes. Unless wait_hints is set, a hint that has to be
+// worked out is not played.
+// Returns the size of the reply, or 0 for a hint that was not played.
+int playFrame(struct session *s, struct Frame *frame, char *out,
+              bool wait_hints) {
+    char guess[WORD_LEN + 1];
+    char reply[REPLY_SIZE];
+    uint64_t token;
+    int size;
+    int slot = findGame(s, frame->game);
+
+    switch (frame->type) {
+    case V2_START:
+    case V2_RESUME:
+        if (slot != -1)
+            return putError(out, frame->game, V2_ERR_GAME_EXISTS);
+        if (s->live == SESSION_GAMES)
+            return putError(out, frame->game, V2_ERR_TOO_MANY);
+        for (slot = 0; s->games[slot].live; slot++)
+            ;
+        if (frame->type == V2_RESUME) {
+            if (frame->payload_len != V2_TOKEN_SIZE)
+                return putError(out, frame->game, V2_ERR_NO_RESUME);
+            memcpy(&token, frame->payload, V2_TOKEN_SIZE);
+            if (!resumeGame(&s->games[slot].game, be64toh(token)))
+                return putError(out, frame->game, V2_ERR_NO_RESUME);
+            logEvent(&logger, LOG_RESUME_GAME, NULL, frame->game);
+        } else if (!startGame(&s->games[slot].game,
+                              s->seq + ((uint64_t)s->started++ << 32),
+                              true)) {
+            // Game n of the connection gets stream seq + n * 2^32, so the
+            // first one gets the same word a v1 connection would have.
+            s->hung_up = true;
+            return putError(out, frame->game, V2_ERR_SHUTDOWN);
+        }
+        s->games[slot].live = true;
+        s->games[slot].id = frame->game;
+        s->live++;
+        return putStarted(out, frame->game, &s->games[slot].game);
+    case V2_GUESS:
+    case V2_HINT:
+        if (slot == -1)
+            return putError(out, frame->game, V2_ERR_NO_GAME);
+        if (frame->type == V2_HINT && !s->games[slot].game.data->hints_on)
+            return putError(out, frame->game, V2_ERR_TYPE);
+        if (frame->type == V2_HINT ||
+            askedHint(&s->games[slot].game, frame->payload,
+                      frame->payload_len)) {
+            if (!wait_hints && hintWaits(&s->games[slot].game))
+                return 0;
+            playHint(&s->games[slot].game, reply);
+        } else {
+            int len = frame->payload_len < WORD_LEN ? frame->payload_len
+                                                    : WORD_LEN;
+            memcpy(guess, frame->payload, len);
+            guess[len] = '\0';
+            playGuess(&s->games[slot].game, guess,
+                      frame->payload_len == WORD_LEN, reply);
         }
+        // A v1 reply starts with the same byte as the v2 reply type.
+        size = putFrame(out, *reply, frame->game, reply + 1, V2_RESULT_SIZE);
+        if (gameOver(&s->games[slot].game))
+            dropGame(s, slot);
+        return size;
+    case V2_QUIT:
+        if (slot == -1)
+            return putError(out, frame->game, V2_ERR_NO_GAME);
+        logEvent(&logger, LOG_QUIT_GAME, NULL, frame->game);
+        dropGame(s, slot);
+        return putFrame(out, V2_ENDED, frame->game, NULL, 0);
+    case V2_TICKET:
+        return startTicket(s, frame->game, out);
+    case V2_PLAY:
+        return playTicket(frame, out);
+    default:
+        return putError(out, frame->game, V2_ERR_TYPE);
+    }
+}
 
-        evaluateWordleGuess(wordle, recv_buffer, send_buffer + 3);
+// Plays every complete frame in in, as long as the session is still going
+// and out (out_size bytes, out_len of them used) has room for the reply.
+// Whatever is left over stays at the front of in, along with a hint that
+// stopped it, the same as playGuesses().
+// Returns the game if it stopped at such a hint, and NULL otherwise.
+struct game *playFrames(struct session *s, char *in, int *in_len, char *out,
+                        int *out_len, int out_size, bool wait_hints) {
+    struct Frame frame;
+    int used = 0;
+    int size;
+    struct game *waiting = NULL;
+
+    while (!s->hung_up && *out_len + V2_MAX_REPLY <= out_size) {
+        size = parseFrame(in + used, *in_len - used, &frame);
+        if (size == 0)
+            break;
+        if (size == -1) {
+            fprintf(stderr, "THREAD %lu: ERROR: malformed frame\n",
+                    pthread_self());
+            *out_len += putError(out + *out_len, 0, V2_ERR_FRAME);
+            s->hung_up = true;
+            used = *in_len;
+            break;
+        }
+        int reply_size = playFrame(s, &frame, out + *out_len, wait_hints);
+        if (reply_size == 0) {
+            waiting = &s->games[findGame(s, frame.game)].game;
+            break;
+        }
+        used += size;
+        *out_len += reply_size;
+    }
+    memmove(in, in + used, *in_len - used);
+    *in_len -= used;
+    return waiting;
+}
 
-        memset(send_buffer, 'Y', 1);
+// Lets go of every game still going on a session with leaveGame(), which
+// records them as lost for a client that hung up on them.
+void endSession(struct session *s) {
+    for (int i = 0; i < SESSION_GAMES && s->live > 0; i++) {
+        if (s->games[i].live) {
+            leaveGame(&s->games[i].game);
+            s->games[i].live = false;
+            s->live--;
+        }
+    }
+}
 
-        net_short = htons(guesses_remaining);
-        memcpy(send_buffer + 1, &net_short, sizeof(short));
+// Closes a client connection that serveClient() is done with. Game threads
+// take their connection (conn_id) out of the registry, which closes the
+// socket; pool workers are not in any registry and just close it.
+void finishClient(struct Registry *registry, uint64_t conn_id, int csd) {
+    if (registry != NULL) {
+        // The thread is about to exit.
+        releaseLogRing(&logger);
+        uint64_t start = latencyClock(latency);
+        removeRegistry(registry, conn_id);
+        recordSince(latency, LAT_LOCK_WAIT, start);
+    } else
+        close(csd);
+}
 
-#ifdef BAD_AT_THIS
-        printf("THREAD %lu: contents of send buffer after validation:",
-               pthread_self());
-        for (int i = 0; i < 9; i++) {
-            printf(" %02x |", *(send_buffer + i));
-        }
-        printf("\n");
+// Sets TCP_CORK on csd, or clears it, which sends whatever it held back.
+void corkConn(int csd, int on) {
+    if (setsockopt(csd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1)
+        perror("ERROR: setsockopt() failed");
+}
 
-        printf("THREAD %lu: valid: %c  guesses: %02x %02x | %hd reply: %s\n",
-               pthread_self(), *send_buffer, *(send_buffer + 1),
-               *(send_buffer + 2), ntohs(*(short *)(send_buffer + 1)),
-               send_buffer + 3);
-#endif
+// Sets a client socket up for the send mode and the buffer size, as soon as
+// it is accepted.
+void tuneConn(int csd) {
+    int on = 1;
+    if (send_mode == SEND_NODELAY &&
+        setsockopt(csd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+        perror("ERROR: setsockopt() failed");
+    if (socket_buffer > 0 &&
+        (setsockopt(csd, SOL_SOCKET, SO_RCVBUF, &socket_buffer,
+                    sizeof(socket_buffer)) == -1 ||
+         setsockopt(csd, SOL_SOCKET, SO_SNDBUF, &socket_buffer,
+                    sizeof(socket_buffer)) == -1))
+        perror("ERROR: setsockopt() failed");
+}
 
-        // Now we can send a response to the client.
-        bytes_sent = send(csd, send_buffer, 9, 0);
-        printf("THREAD %lu: sending reply: %s (%d guess%s left)\n",
-               pthread_self(), send_buffer + 3, guesses_remaining,
-               (guesses_remaining == 1 ? "" : "es"));
+// Sends every reply in out (len bytes) in as few send() calls as the socket
+// allows, which is one unless its buffer is full.
+// Returns false on error.
+bool sendReplies(int csd, const char *out, int len) {
+    int bytes_sent;
 
+    if (len == 0)
+        return true;
+    if (send_mode == SEND_CORK)
+        corkConn(csd, 1);
+    for (int sent = 0; sent < len; sent += bytes_sent) {
+        bytes_sent = send(csd, out + sent, len - sent, MSG_NOSIGNAL);
         if (bytes_sent == -1) {
             perror("ERROR: send() failed");
-
-            free(wordle);
-            free(recv_buffer);
-            free(send_buffer);
-
-            removeList(running_threads, pthread_self());
-
-            pthread_exit(NULL);
+            return false;
         }
     }
-    // Checking this one more time before just letting the thread finish.
-    if (server_shutdown) {
-        if (signalled)
-            printf("MAIN: SIGUSR1 rcvd; Wordle server shutting down...\n");
-        free(wordle);
-        free(recv_buffer);
-        free(send_buffer);
+    if (send_mode == SEND_CORK)
+        corkConn(csd, 0);
+    return true;
+}
 
-        removeList(running_threads, pthread_self());
-        pthread_exit(NULL);
+// Blocks until there is something to read from the client, or the socket
+// has been shut down. This is poll() rather than select(), which cannot watch
+// a descriptor past FD_SETSIZE, and a server with thousands of games going
+// has plenty of those.
+// Returns false on error.
+bool waitClient(int csd) {
+    struct pollfd pfd = {.fd = csd, .events = POLLIN};
+    if (poll(&pfd, 1, -1) == -1) {
+        if (errno != EINTR)
+            perror("ERROR: poll() failed");
+        return false;
     }
+    return true;
+}
 
-    if (winner) {
-        pthread_mutex_lock(&mutex_wins);
-        { total_wins++; }
-        pthread_mutex_unlock(&mutex_wins);
-    } else {
-        pthread_mutex_lock(&mutex_losses);
-        { total_losses++; }
-        pthread_mutex_unlock(&mutex_losses);
+// Waits for the client's first bytes to work out which protocol it speaks.
+// The hello of a v2 client is read off the socket; anything else, even a
+// client that hangs up straight away, is left for a v1 game.
+// Returns 1 or 2, or -1 if the connection should be closed without playing.
+int readVersion(int csd) {
+    char hello[V2_HELLO_SIZE];
+    int n;
+
+    if (!waitClient(csd))
+        return -1;
+    if (server_shutdown)
+        return -1;
+
+    n = recv(csd, hello, 1, MSG_PEEK);
+    if (n == 1 && *hello == '\0')
+        n = recv(csd, hello, V2_HELLO_SIZE, MSG_PEEK | MSG_WAITALL);
+    if (n == -1) {
+        perror("ERROR: recv() failed");
+        return -1;
     }
-    // Going to do some shenanigans to make this print work
-    for (int i = 0; i < strlen(wordle); i++) {
-        *(wordle + i) = toupper(*(wordle + i));
+    if (n < V2_HELLO_SIZE || memcmp(hello, V2_HELLO, V2_HELLO_SIZE) != 0)
+        return 1;
+    if (recv(csd, hello, V2_HELLO_SIZE, 0) == -1) {
+        perror("ERROR: recv() failed");
+        return -1;
     }
-    printf("THREAD %lu: game over; word was %s!\n", pthread_self(), wordle);
-
-    free(wordle);
-    free(recv_buffer);
-    free(send_buffer);
+    return 2;
+}
 
-    removeList(running_threads, pthread_self());
+// Runs a v2 session with the client on csd: reads whatever frames have
+// arrived, plays them, and sends back all the replies at once.
+// The socket is closed before returning.
+void serveSession(int csd, uint64_t seq, struct Registry *registry,
+                  uint64_t conn_id) {
+    struct session session;
+    char in[CONN_IN_SIZE];
+    char out[CONN_OUT_SIZE];
+    int in_len = 0;
+    int out_len = V2_HELLO_SIZE;
+    int bytes_recieved;
+    uint64_t received_at = 0;
 
-    pthread_exit(NULL);
-}
+    memset(&session, 0, sizeof(session));
+    session.seq = seq;
+    memcpy(out, V2_HELLO, V2_HELLO_SIZE);
+    logEvent(&logger, LOG_PROTOCOL_V2, NULL, 0);
 
-int wordle_server(int argc, char **argv) {
-    struct sigaction kill_action, ign_action;
-    kill_action.sa_handler = killServer;
-    sigemptyset(&kill_action.sa_mask);
-    kill_action.sa_flags = 0;
-    ign_action.sa_handler = SIG_IGN;
-    sigemptyset(&ign_action.sa_mask);
-    ign_action.sa_flags = 0;
+    // Every way out of the loop ends up at endSession().
+    for (;;) {
+        if (!sendReplies(csd, out, out_len))
+            break;
+        if (out_len > 0 && received_at != 0) {
+            recordSince(latency, LAT_SERVICE, received_at);
+            received_at = 0;
+        }
+        out_len = 0;
+        if (server_shutdown || session.hung_up)
+            break;
+
+        // Frames that did not fit in the output last time go first.
+        playFrames(&session, in, &in_len, out, &out_len, CONN_OUT_SIZE, true);
+        if (out_len > 0)
+            continue;
+
+        if (!waitClient(csd) || server_shutdown)
+            break;
+
+        bytes_recieved = recv(csd, in + in_len, CONN_IN_SIZE - in_len, 0);
+        if (bytes_recieved == -1) {
+            perror("ERROR: recv() failed");
+            break;
+        } else if (bytes_recieved == 0) {
+            logEvent(&logger, LOG_GAVE_UP, NULL, 0);
+            break;
+        }
+        in_len += bytes_recieved;
+        received_at = latencyClock(latency);
+    }
+
+    // Same as a v1 game, nothing is counted if the server is shutting down.
+    if (server_shutdown && signalled)
+        logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+    endSession(&session);
+    finishClient(registry, conn_id, csd);
+}
+
+// Plays the client on csd, one blocking guess (or batch of v2 frames) at a
+// time. seq is the connection's place in the order connections were accepted,
+// and accepted_at when that was (from latencyClock()).
+// This is the whole life of a connection in the thread per client and worker
+// pool server modes. The socket is closed before returning.
+void serveClient(int csd, uint64_t seq, uint64_t accepted_at,
+                 struct Registry *registry, uint64_t conn_id) {
+    struct game game;
+    int version = readVersion(csd);
+
+    if (version != -1)
+        recordSince(latency, LAT_FIRST_REQUEST, accepted_at);
+    switch (version) {
+    case 2:
+        serveSession(csd, seq, registry, conn_id);
+        return;
+    case -1:
+        if (server_shutdown && signalled)
+            logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+        finishClient(registry, conn_id, csd);
+        return;
+    default:
+        break;
+    }
+
+    // Checking this variable after every mutex, this is a better alternative to
+    // signals, since I dont need to worry about whether a thread currently
+    // holds a mutex
+    if (!startGame(&game, seq, false)) {
+        if (signalled)
+            logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+
+        finishClient(registry, conn_id, csd);
+        return;
+    }
+    logEvent(&logger, LOG_WAITING, NULL, 0);
+
+    // Because TCP is a stream protocol, guesses are cut out of whatever has
+    // arrived, and everything that can be answered is sent back at once.
+    char in[CONN_IN_SIZE];
+    char out[CONN_OUT_SIZE];
+    int in_len = 0;
+    int out_len = 0;
+    int bytes_recieved;
+    uint64_t received_at = 0;
+
+    // Every way out of the loop ends up at leaveGame().
+    for (;;) {
+        if (!sendReplies(csd, out, out_len))
+            break;
+        if (out_len > 0 && received_at != 0) {
+            recordSince(latency, LAT_SERVICE, received_at);
+            received_at = 0;
+        }
+        out_len = 0;
+        // First thing we are doing is checking if we have been told to stop.
+        // So when the server shuts down, it will finish what it is doing
+        //  and then stop before it would have accepted new input.
+        if (gameOver(&game) || server_shutdown)
+            break;
+
+        // Guesses that did not fit in the output last time go first.
+        playGuesses(&game, in, &in_len, out, &out_len, CONN_OUT_SIZE, true);
+        if (out_len > 0)
+            continue;
+
+        // Block BEFORE the read call...
+        if (!waitClient(csd) || server_shutdown)
+            break;
+        bytes_recieved = recv(csd, in + in_len, CONN_IN_SIZE - in_len, 0);
+
+        if (bytes_recieved == -1) {
+            perror("ERROR: recv() failed");
+            break;
+        } else if (bytes_recieved == 0) { // client disconnected. mark a loss
+                                          // and kill the connection
+            logEvent(&logger, LOG_GAVE_UP, NULL, 0);
+            break;
+        }
+        in_len += bytes_recieved;
+        received_at = latencyClock(latency);
+    }
+    // Checking this one more time before just letting the thread finish:
+    // leaveGame() counts nothing if the server is shutting down.
+    if (server_shutdown && signalled)
+        logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+
+    leaveGame(&game);
+
+    finishClient(registry, conn_id, csd);
+}
+
+void *do_on_thread(void *arguments) {
+    // Each thread gets its own copy of the arguments, so the accept loop
+    // can move on to the next connection without waiting for this one.
+    struct args thread_args = *(struct args *)arguments;
+    free(arguments);
+
+    // May as well check before we start the game
+    if (server_shutdown) {
+        if (signalled)
+            logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+        finishClient(thread_args.registry, thread_args.conn_id,
+                     thread_args.csd);
+        pthread_exit(NULL);
+    }
+
+    serveClient(thread_args.csd, thread_args.seq, thread_args.accepted_at,
+                thread_args.registry, thread_args.conn_id);
+
+    pthread_exit(NULL);
+}
+
+
+
+// Worker pool server mode.
+// A fixed number of worker threads are started up front, and the accept
+// loop hands them connections through a bounded queue. Each worker plays one
+// game at a time with serveClient() and then goes back for the next
+// connection, so no thread is ever created per connection. When every worker
+// is busy and the queue is full, the accept loop waits for room instead of
+// accepting more connections than the pool can take.
+
+void *workerLoop(void *arguments) {
+    int *current_sd = (int *)arguments;
+    struct Client client;
+
+    while (popRing(accept_queue, &client)) {
+        // stopPool() reads this to wake the worker up if it is stuck
+        // waiting on a quiet client at shutdown.
+        atomic_store(current_sd, client.sd);
+        if (server_shutdown) {
+            close(client.sd);
+        } else {
+            serveClient(client.sd, client.seq, client.accepted_at, NULL,
+                        NO_CONN);
+        }
+        atomic_store(current_sd, -1);
+    }
+    atomic_store(current_sd, WORKER_EXITED);
+    return NULL;
+}
+
+// Stops every worker: idle ones are woken up through the queue, and busy ones
+// have the reading side of their socket shut down so they stop waiting for
+// the client. server_shutdown has to be set before this is called.
+// Connections still waiting in the queue are closed without being played.
+void stopPool() {
+    struct Client client;
+    int sd;
+
+    closeRing(accept_queue, num_workers);
+    for (int i = 0; i < num_workers; i++) {
+        sd = atomic_load(worker_sd + i);
+        if (sd >= 0)
+            shutdown(sd, SHUT_RD);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(*(workers + i), NULL);
+    }
+    while (tryPopRing(accept_queue, &client)) {
+        close(client.sd);
+    }
+
+    freeRing(accept_queue);
+    free(workers);
+    free(worker_sd);
+    accept_queue = NULL;
+    workers = NULL;
+    worker_sd = NULL;
+    num_workers = 0;
+}
+
+// Starts count worker threads fed by a queue of queue_size connections.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int startPool(int count, int queue_size) {
+    int rc;
+
+    accept_queue = newRing(queue_size);
+    workers = calloc(count, sizeof(pthread_t));
+    worker_sd = calloc(count, sizeof(atomic_int));
+    if (accept_queue == NULL || workers == NULL || worker_sd == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        if (accept_queue != NULL)
+            freeRing(accept_queue);
+        free(workers);
+        free(worker_sd);
+        accept_queue = NULL;
+        workers = NULL;
+        worker_sd = NULL;
+        return EXIT_FAILURE;
+    }
+
+    for (num_workers = 0; num_workers < count; num_workers++) {
+        atomic_init(worker_sd + num_workers, -1);
+        rc = spawnHelper(workers + num_workers, workerLoop,
+                         worker_sd + num_workers);
+        if (rc != 0) {
+            fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n",
+                    rc);
+            break;
+        }
+    }
+
+    if (num_workers < count) {
+        server_shutdown = 1;
+        stopPool();
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Event loop server mode.
+// Instead of a thread per client, a few reactor threads each wait in
+// epoll_wait() on many non-blocking sockets, and every game is a state
+// machine driven by whatever bytes have arrived for it. The accept loop hands
+// each new connection to the reactors in turn.
+
+// Whether a connection should stay open after being serviced.
+#define CONN_KEEP true
+#define CONN_CLOSE false
+
+// Gives a connection buffers to play its requests in, with the partial
+// request it kept while idle at the front of the input.
+// Returns false on error.
+bool holdBuffers(struct Slab *io_slab, struct conn *c) {
+    if (c->io != NULL)
+        return true;
+    c->io = allocSlab(io_slab);
+    if (c->io == NULL) {
+        fprintf(stderr, "ERROR: out of memory for connection buffers\n");
+        return false;
+    }
+    memcpy(c->io->in, c->partial, c->partial_len);
+    c->io->in_len = c->partial_len;
+    c->partial_len = 0;
+    return true;
+}
+
+// Takes the buffers back from a connection that has nothing left to send,
+// keeping whatever part of a request is left in its input.
+void dropBuffers(struct Slab *io_slab, struct conn *c) {
+    if (c->io == NULL || c->io->out_len > 0 ||
+        c->io->in_len > CONN_PARTIAL_SIZE)
+        return;
+    memcpy(c->partial, c->io->in, c->io->in_len);
+    c->partial_len = c->io->in_len;
+    freeSlab(io_slab, c->io);
+    c->io = NULL;
+}
+
+// Records the games on a connection that is done with, whether they were
+// played to the end or the client hung up on them, or only lets go of them if
+// the server is shutting down. Every way a connection closes comes here.
+void finishConn(struct conn *c) {
+    if (c->version == 1)
+        leaveGame(&c->game);
+    else if (c->version == 2)
+        endSession(c->session);
+}
+
+// Called on a hint engine helper once the hint a connection asked for has
+// been worked out.
+void hintDone(struct HintRequest *request) {
+    struct conn_hint *hint = (struct conn_hint *)request;
+    struct hint_box *box = hint->box;
+    uint64_t wake = 1;
+
+    pthread_mutex_lock(&box->mutex);
+    {
+        hint->next = box->done;
+        box->done = hint;
+    }
+    pthread_mutex_unlock(&box->mutex);
+    if (write(box->wakefd, &wake, sizeof(wake)) == -1)
+        perror("ERROR: write() failed");
+}
+
+// Asks the hint engine's helpers for the hint game is waiting for, which
+// comes back to c through box.
+void askHint(struct hint_box *box, struct conn *c, struct game *game) {
+    struct conn_hint *hint = malloc(sizeof(struct conn_hint));
+    if (hint == NULL) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        c->finished = true;
+        return;
+    }
+    hint->request.guesses = game->played;
+    hint->request.patterns = game->patterns;
+    hint->request.count = MAX_GUESSES - game->guesses_remaining;
+    hint->request.done = hintDone;
+    hint->conn = c;
+    hint->box = box;
+    c->hint = hint;
+    box->waiting++;
+    requestHint(&game->data->hints, &hint->request);
+}
+
+// Takes every hint that has come back out of box.
+// Returns them as a list.
+struct conn_hint *takeHints(struct hint_box *box) {
+    struct conn_hint *done;
+
+    pthread_mutex_lock(&box->mutex);
+    {
+        done = box->done;
+        box->done = NULL;
+    }
+    pthread_mutex_unlock(&box->mutex);
+    return done;
+}
+
+// Puts the reply to the hint a connection was waiting for in its output, in
+// place of the request at the front of its input.
+// Returns false on error.
+bool answerHint(struct Slab *io_slab, struct conn *c, uint32_t hint) {
+    char reply[REPLY_SIZE];
+    struct Frame frame;
+    int used;
+
+    if (!holdBuffers(io_slab, c))
+        return false;
+    struct conn_io *io = c->io;
+    if (c->version == 1) {
+        putHint(&c->game, hint, io->out + io->out_len);
+        io->out_len += REPLY_SIZE;
+        used = WORD_LEN;
+        logEvent(&logger, LOG_WAITING, NULL, 0);
+    } else {
+        // The request is still whole at the front, as it was when played.
+        used = parseFrame(io->in, io->in_len, &frame);
+        int slot = used > 0 ? findGame(c->session, frame.game) : -1;
+        if (slot == -1)
+            return false;
+        putHint(&c->session->games[slot].game, hint, reply);
+        io->out_len += putFrame(io->out + io->out_len, *reply, frame.game,
+                                reply + 1, V2_RESULT_SIZE);
+    }
+    memmove(io->in, io->in + used, io->in_len - used);
+    io->in_len -= used;
+    return true;
+}
+
+// Takes a connection off its reactor and frees it, once its games are
+// finished with. One still waiting for a hint only has its socket closed,
+// and goes once the hint is back.
+void closeConn(struct reactor *r, struct conn *c) {
+    // Closing the socket also takes it out of the epoll set.
+    if (!c->closing)
+        close(c->sd);
+    c->closing = true;
+    if (c->hint != NULL)
+        return;
+    finishConn(c);
+    if (c->io != NULL)
+        freeSlab(&r->io_slab, c->io);
+    free(c->session);
+
+    pthread_mutex_lock(&r->mutex);
+    {
+        if (c->prev != NULL)
+            c->prev->next = c->next;
+        else
+            r->conns = c->next;
+        if (c->next != NULL)
+            c->next->prev = c->prev;
+        freeSlab(&r->conn_slab, c);
+    }
+    pthread_mutex_unlock(&r->mutex);
+}
+
+// Works out which protocol a new connection speaks from its first bytes, and
+// starts its v1 game or its v2 session. eof is true if the client has hung
+// up, which makes whatever it sent a v1 game.
+// Leaves version at 0 if more bytes are needed, and sets finished if the
+// connection cannot go on.
+void greetConn(struct conn *c, bool eof) {
+    struct conn_io *io = c->io;
+    if (io->in_len == 0 && !eof)
+        return;
+    if (io->in_len < V2_HELLO_SIZE && *io->in == '\0' && !eof)
+        return;
+    if (io->in_len > 0)
+        recordSince(latency, LAT_FIRST_REQUEST, c->accepted_at);
+
+    if (io->in_len >= V2_HELLO_SIZE &&
+        memcmp(io->in, V2_HELLO, V2_HELLO_SIZE) == 0) {
+        c->session = calloc(1, sizeof(struct session));
+        if (c->session == NULL) {
+            fprintf(stderr, "ERROR: calloc() failed\n");
+            c->finished = true;
+            return;
+        }
+        c->session->seq = c->seq;
+        c->version = 2;
+        memmove(io->in, io->in + V2_HELLO_SIZE, io->in_len - V2_HELLO_SIZE);
+        io->in_len -= V2_HELLO_SIZE;
+        memcpy(io->out + io->out_len, V2_HELLO, V2_HELLO_SIZE);
+        io->out_len += V2_HELLO_SIZE;
+        logEvent(&logger, LOG_PROTOCOL_V2, NULL, 0);
+        return;
+    }
+
+    if (!startGame(&c->game, c->seq, false)) {
+        c->finished = true;
+        return;
+    }
+    c->version = 1;
+    logEvent(&logger, LOG_WAITING, NULL, 0);
+}
+
+
+// Hands a new connection to the next reactor. Its game does not start until
+// the client's first bytes say which protocol it speaks.
+void dispatchConn(int sd, uint64_t seq, uint64_t accepted_at) {
+    struct reactor *r =
+        reactors + (atomic_fetch_add_explicit(&next_reactor, 1,
+                                              memory_order_relaxed) %
+                    num_reactors);
+    struct conn *c;
+
+    if (fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("ERROR: fcntl() failed");
+        close(sd);
+        return;
+    }
+
+    // The connection has to be on the list before the reactor can see it,
+    // since the reactor may close it as soon as it is added to epoll.
+    pthread_mutex_lock(&r->mutex);
+    {
+        c = allocSlab(&r->conn_slab);
+        if (c != NULL) {
+            c->sd = sd;
+            c->seq = seq;
+            c->accepted_at = accepted_at;
+            c->next = r->conns;
+            if (r->conns != NULL)
+                r->conns->prev = c;
+            r->conns = c;
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+    if (c == NULL) {
+        fprintf(stderr, "ERROR: out of memory for connections\n");
+        close(sd);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, sd, &ev) == -1) {
+        perror("ERROR: epoll_ctl() failed");
+        closeConn(r, c);
+    }
+}
+
+// Plays every complete guess (or v2 frame) waiting in the connection's input,
+// as long as the game is still going and there is room in the output for the
+// reply. Whatever is left over stays at the front of the input.
+// A hint that has to be worked out is handed to the hint engine's helpers,
+// which send it back through box, and nothing more is played until it is
+// back.
+// Returns true if any replies were added to the output.
+bool playBuffered(struct conn *c, struct hint_box *box) {
+    struct conn_io *io = c->io;
+    int out_len = io->out_len;
+    struct game *waiting;
+
+    if (c->hint != NULL)
+        return false;
+    if (c->version == 0 && !c->finished)
+        greetConn(c, false);
+    if (c->version == 2) {
+        waiting = playFrames(c->session, io->in, &io->in_len, io->out,
+                             &io->out_len, CONN_OUT_SIZE, false);
+        c->finished = c->session->hung_up;
+    } else if (c->version == 1) {
+        waiting = playGuesses(&c->game, io->in, &io->in_len, io->out,
+                              &io->out_len, CONN_OUT_SIZE, false);
+        c->finished = gameOver(&c->game);
+    } else {
+        return io->out_len > out_len;
+    }
+    if (waiting != NULL)
+        askHint(box, c, waiting);
+    return io->out_len > out_len;
+}
+
+// Sends as much of the pending output as the socket will take.
+// Returns false if the connection is broken.
+bool flushConn(struct conn *c) {
+    struct conn_io *io = c->io;
+    if (send_mode == SEND_CORK && io->out_sent == 0 && io->out_len > 0)
+        corkConn(c->sd, 1);
+    while (io->out_sent < io->out_len) {
+        int bytes_sent = send(c->sd, io->out + io->out_sent,
+                              io->out_len - io->out_sent, MSG_NOSIGNAL);
+        if (bytes_sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: send() failed");
+            return false;
+        }
+        io->out_sent += bytes_sent;
+    }
+    if (send_mode == SEND_CORK && io->out_len > 0)
+        corkConn(c->sd, 0);
+    io->out_len = io->out_sent = 0;
+    if (c->received_at != 0) {
+        recordSince(latency, LAT_SERVICE, c->received_at);
+        c->received_at = 0;
+    }
+    return true;
+}
+
+// Waits for the socket to become writable if there is output left over,
+// for nothing if the input is full behind a hint being worked out, or for
+// more input otherwise.
+bool watchConn(struct reactor *r, struct conn *c) {
+    struct epoll_event ev;
+    if (c->io->out_len > 0)
+        ev.events = EPOLLOUT;
+    else if (c->hint != NULL && c->io->in_len == CONN_IN_SIZE)
+        ev.events = 0;
+    else
+        ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, c->sd, &ev) == -1) {
+        perror("ERROR: epoll_ctl() failed");
+        return false;
+    }
+    return true;
+}
+
+// Plays whatever input is waiting and sends the replies, for as long as the
+// socket keeps taking them.
+// Returns CONN_CLOSE once the connection is finished with.
+bool pumpConn(struct reactor *r, struct conn *c) {
+    do {
+        if (!flushConn(c))
+            return CONN_CLOSE;
+        if (c->io->out_len > 0)
+            return watchConn(r, c);
+        if (c->finished)
+            return CONN_CLOSE;
+    } while (playBuffered(c, &r->hints));
+    return CONN_KEEP;
+}
+
+// Runs a connection forward after epoll reports it ready.
+// This is the event loop version of the loop in do_on_thread(): read what has
+// arrived, play every complete guess in it, and send the replies.
+// Returns CONN_CLOSE once the connection is finished with.
+bool serviceConn(struct reactor *r, struct conn *c, uint32_t events) {
+    if (!holdBuffers(&r->io_slab, c))
+        return CONN_CLOSE;
+    struct conn_io *io = c->io;
+
+    // Finish off any replies the socket would not take last time.
+    if (io->out_len > 0) {
+        if (!flushConn(c))
+            return CONN_CLOSE;
+        if (io->out_len > 0)
+            return CONN_KEEP;
+        if (!watchConn(r, c))
+            return CONN_CLOSE;
+    }
+
+    // A full input is played before reading any more; the socket stays
+    // readable until then.
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+        io->in_len < CONN_IN_SIZE) {
+        int bytes_recieved =
+            recv(c->sd, io->in + io->in_len, CONN_IN_SIZE - io->in_len, 0);
+        if (bytes_recieved == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("ERROR: recv() failed");
+                return CONN_CLOSE;
+            }
+        } else if (bytes_recieved == 0) { // client disconnected. mark a loss
+            logEvent(&logger, LOG_GAVE_UP, NULL, 0);
+            if (c->version == 0)
+                greetConn(c, true);
+            return CONN_CLOSE;
+        } else {
+            io->in_len += bytes_recieved;
+            if (c->received_at == 0)
+                c->received_at = latencyClock(latency);
+        }
+    }
+
+    if (!playBuffered(c, &r->hints) && !c->finished) {
+        // Nothing more can be read until the hint is back.
+        if (c->hint != NULL && io->in_len == CONN_IN_SIZE)
+            return watchConn(r, c);
+        return CONN_KEEP;
+    }
+    return pumpConn(r, c);
+}
+
+// Answers the hints that have come back for the reactor's connections, and
+// carries on playing them.
+void answerHints(struct reactor *r) {
+    uint64_t wakes;
+    if (read(r->wakefd, &wakes, sizeof(wakes)) == -1 && errno != EAGAIN)
+        perror("ERROR: read() failed");
+
+    struct conn_hint *hint = takeHints(&r->hints);
+    while (hint != NULL) {
+        struct conn_hint *next = hint->next;
+        struct conn *c = hint->conn;
+        c->hint = NULL;
+        r->hints.waiting--;
+        if (c->closing) {
+            closeConn(r, c);
+        } else if (!server_shutdown) {
+            if (!answerHint(&r->io_slab, c, hint->request.hint) ||
+                pumpConn(r, c) == CONN_CLOSE || !watchConn(r, c))
+                closeConn(r, c);
+            else
+                dropBuffers(&r->io_slab, c);
+        }
+        free(hint);
+        hint = next;
+    }
+}
+
+void *reactorLoop(void *arguments) {
+    struct reactor *r = (struct reactor *)arguments;
+    struct epoll_event events[REACTOR_EVENTS];
+    int n;
+
+    while (!server_shutdown) {
+        n = epoll_wait(r->epfd, events, REACTOR_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: epoll_wait() failed");
+            break;
+        }
+        bool woken = false;
+        for (int i = 0; i < n; i++) {
+            struct conn *c = (struct conn *)events[i].data.ptr;
+            // A NULL connection is the wakeup from stopReactors(), or from
+            // a hint coming back.
+            if (c == NULL) {
+                woken = true;
+                continue;
+            }
+            if (serviceConn(r, c, events[i].events) == CONN_CLOSE)
+                closeConn(r, c);
+            else
+                dropBuffers(&r->io_slab, c);
+        }
+        // Not until every event is handled, since answering a hint can free
+        // a connection that one of them is for.
+        if (woken)
+            answerHints(r);
+    }
+
+    // A connection waiting for a hint is needed until the hint is back,
+    // which the helpers always get to. Should poll() fail, the hints are
+    // looked for every so often instead.
+    while (r->hints.waiting > 0) {
+        struct pollfd wake = {.fd = r->wakefd, .events = POLLIN};
+        if (poll(&wake, 1, -1) == -1 && errno != EINTR) {
+            perror("ERROR: poll() failed");
+            usleep(HINT_POLL_US);
+        }
+        answerHints(r);
+    }
+    // Same as a game thread that sees server_shutdown: whatever games are
+    // still going just stop, without counting as a win or a loss, and let go
+    // of their game data. Goes through the list once, since closeConn()
+    // leaves a connection still waiting for a hint on it.
+    for (struct conn *c = r->conns, *next; c != NULL; c = next) {
+        next = c->next;
+        closeConn(r, c);
+    }
+    return NULL;
+}
+
+// Wakes every reactor, waits for it to close its connections and exit.
+// server_shutdown has to be set before this is called.
+void stopReactors() {
+    uint64_t wake = 1;
+
+    for (int i = 0; i < num_reactors; i++) {
+        struct reactor *r = reactors + i;
+        if (write(r->wakefd, &wake, sizeof(wake)) == -1)
+            perror("ERROR: write() failed");
+        pthread_join(r->tid, NULL);
+        close(r->epfd);
+        close(r->wakefd);
+        pthread_mutex_destroy(&r->mutex);
+        pthread_mutex_destroy(&r->hints.mutex);
+        destroySlab(&r->conn_slab);
+        destroySlab(&r->io_slab);
+    }
+    free(reactors);
+    reactors = NULL;
+    num_reactors = 0;
+}
+
+// Starts count reactor threads.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int startReactors(int count) {
+    int per_reactor = slab_games / count;
+    int rc;
+
+    reactors = calloc(count, sizeof(struct reactor));
+    if (reactors == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (num_reactors = 0; num_reactors < count; num_reactors++) {
+        struct reactor *r = reactors + num_reactors;
+        struct epoll_event ev;
+
+        pthread_mutex_init(&r->mutex, NULL);
+        pthread_mutex_init(&r->hints.mutex, NULL);
+        if (!initSlab(&r->conn_slab, sizeof(struct conn), per_reactor) ||
+            !initSlab(&r->io_slab, sizeof(struct conn_io), per_reactor)) {
+            perror("ERROR: mmap() failed");
+            r->epfd = r->wakefd = -1;
+            break;
+        }
+        r->epfd = epoll_create1(EPOLL_CLOEXEC);
+        r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (r->epfd == -1 || r->wakefd == -1) {
+            perror("ERROR: epoll_create1() failed");
+            break;
+        }
+        r->hints.wakefd = r->wakefd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) == -1) {
+            perror("ERROR: epoll_ctl() failed");
+            break;
+        }
+
+        rc = spawnHelper(&r->tid, reactorLoop, r);
+        if (rc != 0) {
+            fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n",
+                    rc);
+            break;
+        }
+    }
+
+    if (num_reactors < count) {
+        // Only the reactors that started need stopping.
+        struct reactor *r = reactors + num_reactors;
+        if (r->epfd != -1)
+            close(r->epfd);
+        if (r->wakefd != -1)
+            close(r->wakefd);
+        pthread_mutex_destroy(&r->mutex);
+        pthread_mutex_destroy(&r->hints.mutex);
+        destroySlab(&r->conn_slab);
+        destroySlab(&r->io_slab);
+        server_shutdown = 1;
+        stopReactors();
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+#ifdef HAVE_IO_URING
+// io_uring server mode.
+// One ring, driven from the main thread, does all the I/O: a multishot
+// accept on the listener, a multishot recv per connection that picks its
+// buffers from a shared provided buffer ring, and a send per batch of
+// replies. Every pass of the loop submits everything queued up while
+// handling the previous batch of completions and waits for the next batch
+// in the same io_uring_enter(), so under load a single system call covers
+// many guesses across many games.
+// A multishot recv cannot be told to stop delivering, so a client may have at
+// most CONN_IN_SIZE bytes of requests outstanding; one that pipelines more
+// than that is disconnected.
+// Hints that have to be worked out go to the hint engine's helpers, and a
+// read on an eventfd brings them back into the loop.
+
+// What a completion is for, kept in the low bits of its user data. The rest
+// is the connection it belongs to (NULL for the accept and the hints).
+enum uring_op {
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND,
+    URING_CANCEL,
+    URING_HINT
+};
+#define URING_OP_MASK 7
+_Static_assert(_Alignof(struct conn) > URING_OP_MASK,
+               "struct conn leaves no room for the op in its address");
+
+struct uring_server {
+    struct io_uring ring;
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    int listener;
+    struct conn *conns;
+    struct Slab conn_slab;
+    struct Slab io_slab;
+    struct hint_box hints;
+    uint64_t hint_wakes; // where the read on the hints' eventfd goes
+};
+
+// Returns a submission queue entry, flushing the queue to the kernel first if
+// it is full.
+struct io_uring_sqe *getSqe(struct uring_server *u) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+    while (sqe == NULL) {
+        io_uring_submit(&u->ring);
+        sqe = io_uring_get_sqe(&u->ring);
+    }
+    return sqe;
+}
+
+void queueOp(struct io_uring_sqe *sqe, struct conn *c, enum uring_op op) {
+    io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)c | op);
+}
+
+void armAccept(struct uring_server *u) {
+    struct io_uring_sqe *sqe = getSqe(u);
+    io_uring_prep_multishot_accept(sqe, u->listener, NULL, NULL, 0);
+    queueOp(sqe, NULL, URING_ACCEPT);
+}
+
+void armRecv(struct uring_server *u, struct conn *c) {
+    struct io_uring_sqe *sqe = getSqe(u);
+    io_uring_prep_recv_multishot(sqe, c->sd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    queueOp(sqe, c, URING_RECV);
+    c->pending_ops++;
+}
+
+// Waits for hints to come back from the hint engine.
+void armHints(struct uring_server *u) {
+    struct io_uring_sqe *sqe = getSqe(u);
+    io_uring_prep_read(sqe, u->hints.wakefd, &u->hint_wakes,
+                       sizeof(u->hint_wakes), 0);
+    queueOp(sqe, NULL, URING_HINT);
+}
+
+// Sends everything in the connection's output that is not already on its
+// way. Only one send per connection is in flight at a time, so replies go
+// out in order.
+void armSend(struct uring_server *u, struct conn *c) {
+    struct conn_io *io = c->io;
+    if (io->out_sent > 0 || io->out_len == 0)
+        return;
+    struct io_uring_sqe *sqe = getSqe(u);
+    io_uring_prep_send(sqe, c->sd, io->out, io->out_len, MSG_NOSIGNAL);
+    queueOp(sqe, c, URING_SEND);
+    io->out_sent = io->out_len;
+    c->pending_ops++;
+}
+
+// Starts taking a connection down. The connection is freed once the kernel
+// has finished with its recv and any send still in flight.
+void retireConn(struct uring_server *u, struct conn *c) {
+    if (c->closing)
+        return;
+    c->closing = true;
+    struct io_uring_sqe *sqe = getSqe(u);
+    io_uring_prep_cancel_fd(sqe, c->sd, 0);
+    queueOp(sqe, NULL, URING_CANCEL);
+}
+
+void freeUringConn(struct uring_server *u, struct conn *c) {
+    finishConn(c);
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        u->conns = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    close(c->sd);
+    free(c->session);
+    if (c->io != NULL)
+        freeSlab(&u->io_slab, c->io);
+    freeSlab(&u->conn_slab, c);
+}
+
+void uringAccepted(struct uring_server *u, int sd) {
+    logEvent(&logger, LOG_CONNECTION, NULL, 0);
+    tuneConn(sd);
+
+    struct conn *c = allocSlab(&u->conn_slab);
+    if (c == NULL) {
+        fprintf(stderr, "ERROR: out of memory for connections\n");
+        close(sd);
+        return;
+    }
+    c->sd = sd;
+    c->seq = games_accepted++;
+    c->accepted_at = latencyClock(latency);
+
+    c->next = u->conns;
+    if (u->conns != NULL)
+        u->conns->prev = c;
+    u->conns = c;
+    armRecv(u, c);
+}
+
+// Handles data (or the end of the stream) from a connection's multishot
+// recv.
+void uringReceived(struct uring_server *u, struct conn *c,
+                   struct io_uring_cqe *cqe) {
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    if (!more)
+        c->pending_ops--;
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char *data = u->buffers + bid * URING_BUFFER_SIZE;
+
+        if (!c->closing) {
+            if (!holdBuffers(&u->io_slab, c)) {
+                retireConn(u, c);
+            } else if (c->io->in_len + cqe->res > CONN_IN_SIZE) {
+                fprintf(stderr, "THREAD %lu: ERROR: client sent too many "
+                                "guesses at once\n",
+                        pthread_self());
+                retireConn(u, c);
+            } else {
+                memcpy(c->io->in + c->io->in_len, data, cqe->res);
+                c->io->in_len += cqe->res;
+                if (c->received_at == 0)
+                    c->received_at = latencyClock(latency);
+                playBuffered(c, &u->hints);
+                armSend(u, c);
+                if (c->finished && c->io->out_len == 0)
+                    retireConn(u, c);
+                else
+                    dropBuffers(&u->io_slab, c);
+            }
+        }
 
-    sigaction(SIGINT, &ign_action, NULL);
-    sigaction(SIGTERM, &ign_action, NULL);
-    sigaction(SIGUSR2, &ign_action, NULL);
-    sigaction(SIGUSR1, &kill_action, NULL);
+        // The data has been copied out, so the buffer can go straight back.
+        io_uring_buf_ring_add(u->buf_ring, data, URING_BUFFER_SIZE, bid,
+                              io_uring_buf_ring_mask(URING_BUFFERS), 0);
+        io_uring_buf_ring_advance(u->buf_ring, 1);
+
+        if (!more && !c->closing)
+            armRecv(u, c);
+    } else if (cqe->res == -ENOBUFS && !c->closing) {
+        // Every buffer was in use; they are all back by now.
+        armRecv(u, c);
+    } else if (!c->closing) {
+        if (cqe->res == 0) { // client disconnected. mark a loss
+            logEvent(&logger, LOG_GAVE_UP, NULL, 0);
+            if (c->version == 0 && holdBuffers(&u->io_slab, c))
+                greetConn(c, true);
+        } else {
+            errno = -cqe->res;
+            perror("ERROR: recv() failed");
+        }
+        retireConn(u, c);
+    }
 
-    if (argc != 5) {
-        return badInput();
+    if (c->closing && c->pending_ops == 0 && c->hint == NULL)
+        freeUringConn(u, c);
+}
+
+void uringSent(struct uring_server *u, struct conn *c,
+               struct io_uring_cqe *cqe) {
+    struct conn_io *io = c->io;
+    int sent = io->out_sent;
+    c->pending_ops--;
+    io->out_sent = 0;
+
+    if (cqe->res < 0) {
+        if (!c->closing) {
+            errno = -cqe->res;
+            perror("ERROR: send() failed");
+            retireConn(u, c);
+        }
+    } else if (!c->closing) {
+        // A short send leaves the rest at the front for the next one.
+        if (cqe->res < sent)
+            sent = cqe->res;
+        memmove(io->out, io->out + sent, io->out_len - sent);
+        io->out_len -= sent;
+        if (io->out_len == 0 && c->received_at != 0) {
+            recordSince(latency, LAT_SERVICE, c->received_at);
+            c->received_at = 0;
+        }
+
+        // Room may have opened up for guesses that were waiting.
+        playBuffered(c, &u->hints);
+        if (io->out_len > 0) {
+            armSend(u, c);
+        } else if (c->finished) {
+            retireConn(u, c);
+        } else {
+            dropBuffers(&u->io_slab, c);
+        }
     }
 
-    unsigned short tcp_port;
-    if (sscanf(*(argv + 1), "%hd", &tcp_port) == EOF) {
-        return badInput();
+    if (c->closing && c->pending_ops == 0 && c->hint == NULL)
+        freeUringConn(u, c);
+}
+
+// Answers the hints that have come back, and carries on playing their
+// connections.
+void answerUringHints(struct uring_server *u) {
+    struct conn_hint *hint = takeHints(&u->hints);
+    while (hint != NULL) {
+        struct conn_hint *next = hint->next;
+        struct conn *c = hint->conn;
+        c->hint = NULL;
+        u->hints.waiting--;
+        if (!c->closing && !server_shutdown) {
+            if (!answerHint(&u->io_slab, c, hint->request.hint)) {
+                retireConn(u, c);
+            } else {
+                playBuffered(c, &u->hints);
+                armSend(u, c);
+                if (c->finished && c->io->out_len == 0)
+                    retireConn(u, c);
+                else
+                    dropBuffers(&u->io_slab, c);
+            }
+        }
+        if (c->closing && c->pending_ops == 0 && c->hint == NULL)
+            freeUringConn(u, c);
+        free(hint);
+        hint = next;
     }
+}
 
-    unsigned int seed;
-    if (sscanf(*(argv + 2), "%u", &seed) == EOF) {
-        return badInput();
+// Runs the io_uring server on listener until the server is shut down.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int runUring(int listener) {
+    struct uring_server u;
+    struct io_uring_params params;
+    struct io_uring_cqe *cqe;
+    unsigned head, seen;
+    int rc;
+
+    memset(&u, 0, sizeof(u));
+    u.listener = listener;
+    if (!initSlab(&u.conn_slab, sizeof(struct conn), slab_games) ||
+        !initSlab(&u.io_slab, sizeof(struct conn_io), slab_games)) {
+        perror("ERROR: mmap() failed");
+        destroySlab(&u.conn_slab);
+        destroySlab(&u.io_slab);
+        return EXIT_FAILURE;
+    }
+    // Blocking, since the ring waits on it.
+    u.hints.wakefd = eventfd(0, EFD_CLOEXEC);
+    if (u.hints.wakefd == -1) {
+        perror("ERROR: eventfd() failed");
+        destroySlab(&u.conn_slab);
+        destroySlab(&u.io_slab);
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&u.hints.mutex, NULL);
+
+    // Only this thread ever touches the ring, which lets the kernel skip
+    // some locking and run completions when we ask for them.
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    rc = io_uring_queue_init_params(URING_ENTRIES, &u.ring, &params);
+    if (rc == -EINVAL) {
+        // Older kernels do not know those flags.
+        memset(&params, 0, sizeof(params));
+        rc = io_uring_queue_init_params(URING_ENTRIES, &u.ring, &params);
+    }
+    if (rc < 0) {
+        errno = -rc;
+        perror("ERROR: io_uring_queue_init() failed");
+        close(u.hints.wakefd);
+        pthread_mutex_destroy(&u.hints.mutex);
+        destroySlab(&u.conn_slab);
+        destroySlab(&u.io_slab);
+        return EXIT_FAILURE;
     }
 
-    char *dict_fn = calloc(BUFFER_SIZE, sizeof(char));
-    if (dict_fn == NULL) {
-        fprintf(stderr, "ERROR: calloc() failed\n");
+    u.buffers = malloc(URING_BUFFERS * URING_BUFFER_SIZE);
+    u.buf_ring =
+        io_uring_setup_buf_ring(&u.ring, URING_BUFFERS, URING_BGID, 0, &rc);
+    if (u.buffers == NULL || u.buf_ring == NULL) {
+        errno = u.buffers == NULL ? ENOMEM : -rc;
+        perror("ERROR: io_uring_setup_buf_ring() failed");
+        if (u.buf_ring != NULL)
+            io_uring_free_buf_ring(&u.ring, u.buf_ring, URING_BUFFERS,
+                                   URING_BGID);
+        free(u.buffers);
+        io_uring_queue_exit(&u.ring);
+        close(u.hints.wakefd);
+        pthread_mutex_destroy(&u.hints.mutex);
+        destroySlab(&u.conn_slab);
+        destroySlab(&u.io_slab);
         return EXIT_FAILURE;
     }
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        io_uring_buf_ring_add(u.buf_ring, u.buffers + i * URING_BUFFER_SIZE,
+                              URING_BUFFER_SIZE, i,
+                              io_uring_buf_ring_mask(URING_BUFFERS), i);
+    }
+    io_uring_buf_ring_advance(u.buf_ring, URING_BUFFERS);
 
-    if (sscanf(*(argv + 3), "%s", dict_fn) == EOF) {
-        return badInput();
+    armAccept(&u);
+    armHints(&u);
+    rc = EXIT_SUCCESS;
+    while (!server_shutdown) {
+        int ret = io_uring_submit_and_wait(&u.ring, 1);
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY) {
+            errno = -ret;
+            perror("ERROR: io_uring_submit_and_wait() failed");
+            rc = EXIT_FAILURE;
+            break;
+        }
+
+        seen = 0;
+        io_uring_for_each_cqe(&u.ring, head, cqe) {
+            uint64_t data = io_uring_cqe_get_data64(cqe);
+            struct conn *c = (struct conn *)(uintptr_t)(data & ~URING_OP_MASK);
+
+            switch (data & URING_OP_MASK) {
+            case URING_ACCEPT:
+                if (cqe->res >= 0) {
+                    uringAccepted(&u, cqe->res);
+                } else {
+                    errno = -cqe->res;
+                    perror("ERROR: accept() failed");
+                }
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    armAccept(&u);
+                break;
+            case URING_RECV:
+                uringReceived(&u, c, cqe);
+                break;
+            case URING_SEND:
+                uringSent(&u, c, cqe);
+                break;
+            case URING_HINT:
+                if (cqe->res < 0) {
+                    errno = -cqe->res;
+                    perror("ERROR: read() failed");
+                }
+                answerUringHints(&u);
+                armHints(&u);
+                break;
+            default:
+                break;
+            }
+            seen++;
+        }
+        io_uring_cq_advance(&u.ring, seen);
     }
 
-    int dict_size;
-    if (sscanf(*(argv + 4), "%d", &dict_size) == EOF) {
-        return badInput();
+    // Tearing the ring down cancels everything still in flight, after which
+    // the connections can go, once the hints they are waiting for are back.
+    // Same as every other mode, games that are still going are not counted.
+    io_uring_free_buf_ring(&u.ring, u.buf_ring, URING_BUFFERS, URING_BGID);
+    io_uring_queue_exit(&u.ring);
+    free(u.buffers);
+    while (u.hints.waiting > 0) {
+        if (read(u.hints.wakefd, &u.hint_wakes, sizeof(u.hint_wakes)) == -1 &&
+            errno != EINTR) {
+            perror("ERROR: read() failed");
+            usleep(HINT_POLL_US);
+        }
+        answerUringHints(&u);
     }
-    char **dict = calloc(dict_size, sizeof(char *));
+    while (u.conns != NULL)
+        freeUringConn(&u, u.conns);
+    close(u.hints.wakefd);
+    pthread_mutex_destroy(&u.hints.mutex);
+    destroySlab(&u.conn_slab);
+    destroySlab(&u.io_slab);
+    return rc;
+}
+#endif
 
-    FILE *dict_in = fopen(dict_fn, "r");
-    if (dict_in == NULL) {
-        perror("ERROR: open() failed");
-        free(dict);
-        free(dict_fn);
-        return EXIT_FAILURE;
+// Accepting connections.
+
+// Accepts a connection on listener and hands it to whichever part of the
+// server plays it.
+// Returns false on an error the server cannot carry on after.
+bool acceptConn(int listener, struct Registry *clients) {
+    struct sockaddr_in remote_client;
+    socklen_t addrlen = sizeof(remote_client);
+    struct args *thread_args;
+    pthread_t new_thread;
+    int rc;
+
+    int sd = accept(listener, (struct sockaddr *)&remote_client, &addrlen);
+    if (sd == -1) {
+        // The client can give up between poll() and accept().
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED ||
+            errno == EINTR)
+            return true;
+        perror("ERROR: accept() failed");
+        return false;
     }
 
-    printf("MAIN: opened %s (%d words)\n", dict_fn, dict_size);
+    uint64_t accepted_at = latencyClock(latency);
+    logEvent(&logger, LOG_CONNECTION, NULL, 0);
+    tuneConn(sd);
+    uint64_t seq =
+        atomic_fetch_add_explicit(&games_accepted, 1, memory_order_relaxed);
+
+    if (mode == MODE_EPOLL) {
+        dispatchConn(sd, seq, accepted_at);
+        recordSince(latency, LAT_ACCEPT, accepted_at);
+        return true;
+    } else if (mode == MODE_POOL) {
+        // Blocks while the queue is full, which holds back the accept
+        // loop until a worker frees up.
+        if (!pushRing(accept_queue, (struct Client){sd, seq, accepted_at}))
+            close(sd);
+        recordSince(latency, LAT_ACCEPT, accepted_at);
+        return true;
+    }
 
-    free(dict_fn);
+    thread_args = malloc(sizeof(struct args));
+    if (thread_args == NULL) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        close(sd);
+        return false;
+    }
+    thread_args->csd = sd;
+    thread_args->seq = seq;
+    thread_args->accepted_at = accepted_at;
+    thread_args->registry = clients;
 
-    // populate our dictionary
-    if (readDict(dict_in, dict, dict_size) != 0) {
-        // I cant make any guarantees about the state of dict here.
-        // Better off just stopping and letting the system clean it up. :<
-        // This is a bad way to do this
-        return EXIT_FAILURE;
+    // Whoever is accepting sees server_shutdown next and stops.
+    if (server_shutdown) {
+        free(thread_args);
+        close(sd);
+        return true;
     }
 
-    fclose(dict_in);
+    // The connection goes in the registry before its thread starts,
+    // so the thread can take it out again as soon as it likes.
+    uint64_t start = latencyClock(latency);
+    thread_args->conn_id = addRegistry(clients, sd);
+    recordSince(latency, LAT_LOCK_WAIT, start);
+    if (thread_args->conn_id == NO_CONN) {
+        fprintf(stderr, "ERROR: malloc() failed\n");
+        free(thread_args);
+        close(sd);
+        return false;
+    }
 
-#ifdef BAD_AT_THIS
-    printf("MAIN: Successfully populated dictionary.\n");
-#endif
+    rc = pthread_create(&new_thread,
+                        num_acceptors > 0 ? &game_thread_attr : NULL,
+                        do_on_thread, thread_args);
+    if (rc != 0) {
+        fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n", rc);
 
-    srand(seed);
-    printf("MAIN: seeded pseudo-random number generator with %d\n", seed);
+        // Closes sd.
+        removeRegistry(clients, thread_args->conn_id);
+        free(thread_args);
+        return false;
+    }
+    recordSince(latency, LAT_ACCEPT, accepted_at);
 
-    // Start server setup
+    // Finally, detach the thread so we dont need to join it anymore.
+    if (pthread_detach(new_thread) != 0) {
+        fprintf(stderr, "ERROR: pthread_detach failed()\n");
+        return false;
+    }
+    return true;
+}
+
+// Accepts on one of the SO_REUSEPORT listeners until the acceptors are
+// stopped. An error that would stop the main accept loop stops every
+// acceptor instead, and wakes the main thread up to shut the server down.
+void *acceptorLoop(void *arguments) {
+    int listener = *(int *)arguments;
+    struct pollfd fds[2] = {{listener, POLLIN, 0},
+                            {acceptor_pipe[0], POLLIN, 0}};
+    char stop = 1;
+
+    while (!server_shutdown) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: poll() failed");
+        } else if (fds[1].revents != 0) {
+            break;
+        } else if (acceptConn(listener, acceptor_clients)) {
+            continue;
+        }
+        if (write(acceptor_pipe[1], &stop, 1) == -1)
+            perror("ERROR: write() failed");
+        break;
+    }
+    releaseLogRing(&logger);
+    return NULL;
+}
+
+// Stops the acceptor threads, leaving their listeners open.
+void stopAcceptors() {
+    char stop = 1;
+    if (write(acceptor_pipe[1], &stop, 1) == -1)
+        perror("ERROR: write() failed");
+    for (int i = 0; i < num_acceptors; i++) {
+        pthread_join(*(acceptors + i), NULL);
+    }
+    close(acceptor_pipe[0]);
+    close(acceptor_pipe[1]);
+    acceptor_pipe[0] = acceptor_pipe[1] = -1;
+    num_acceptors = 0;
+    pthread_attr_destroy(&game_thread_attr);
+}
+
+// Starts a thread accepting on each listener, each pinned to a CPU of its
+// own for as long as there are enough to go round.
+// Returns EXIT_FAILURE on error and EXIT_SUCCESS otherwise
+int startAcceptors(struct Registry *clients) {
+    static int cpus[CPU_SETSIZE];
+    int num_cpus = 0;
+    cpu_set_t allowed, cpu;
+    int rc = 0;
+
+    acceptor_clients = clients;
+    if (pipe2(acceptor_pipe, O_CLOEXEC) == -1) {
+        perror("ERROR: pipe2() failed");
+        return EXIT_FAILURE;
+    }
+    pthread_attr_init(&game_thread_attr);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        pthread_attr_setaffinity_np(&game_thread_attr, sizeof(allowed),
+                                    &allowed);
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed))
+                *(cpus + num_cpus++) = c;
+        }
+    }
 
-    int listener = socket(AF_INET, SOCK_STREAM, 0);
-    if (listener == -1) {
-        perror("ERROR: socket() failed");
-        for (int i = 0; i < dict_size; i++) {
-            free(*(dict + i));
+    for (num_acceptors = 0; num_acceptors < num_listeners; num_acceptors++) {
+        int *listener = listeners + num_acceptors;
+        // A listener only ever wakes its own acceptor, but the connection
+        // can still be gone by the time it gets to accept().
+        if (fcntl(*listener, F_SETFL, fcntl(*listener, F_GETFL) | O_NONBLOCK) ==
+            -1) {
+            perror("ERROR: fcntl() failed");
+            break;
+        }
+        rc = spawnHelper(acceptors + num_acceptors, acceptorLoop, listener);
+        if (rc != 0) {
+            fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n",
+                    rc);
+            break;
         }
+        if (num_cpus > 0) {
+            CPU_ZERO(&cpu);
+            CPU_SET(*(cpus + num_acceptors % num_cpus), &cpu);
+            pthread_setaffinity_np(*(acceptors + num_acceptors), sizeof(cpu),
+                                   &cpu);
+        }
+    }
 
-        free(dict);
+    if (num_acceptors < num_listeners) {
+        stopAcceptors();
         return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
+
+// Hot upgrades.
+
+// Whether every connection this server accepted has been played to the end.
+bool serverIdle(struct Registry *clients) {
+    if (sizeRegistry(clients) != 0)
+        return false;
+    for (int i = 0; i < num_workers; i++) {
+        if (atomic_load(worker_sd + i) != WORKER_EXITED)
+            return false;
+    }
+    for (int i = 0; i < num_reactors; i++) {
+        struct reactor *r = reactors + i;
+        pthread_mutex_lock(&r->mutex);
+        bool idle = r->conns == NULL;
+        pthread_mutex_unlock(&r->mutex);
+        if (!idle)
+            return false;
+    }
+    return true;
+}
+
+// Waits for the games in progress to finish, for a server that has handed
+// its listener over, and no longer accepts anything. Pool workers play what
+// is left in the queue first. Stops waiting if the server is told to shut
+// down.
+void drainServer(struct Registry *clients) {
+    if (accept_queue != NULL)
+        closeRing(accept_queue, num_workers);
+    while (!server_shutdown && !serverIdle(clients))
+        usleep(DRAIN_POLL_US);
+}
+
+// Starts a new copy of the server to take over from this one.
+void startUpgrade() {
+    if (successor_fd != -1)
+        return; // one is on the way already
+    successor = spawnUpgrade(server_argv, &successor_fd);
+    if (successor != -1)
+        logText(&logger, "MAIN: SIGUSR2 rcvd; started server %d to take over\n",
+                successor);
+}
+
+// Called when the new server has something to say, which is either that it
+// is ready for the listeners or (if it could not start) nothing at all.
+// Returns true if the listeners were handed over.
+bool handOver(struct Registry *clients) {
+    bool accepting = num_acceptors > 0;
+    char ready;
+
+    if (read(successor_fd, &ready, 1) == 1 && ready == UPGRADE_READY) {
+        // Nothing more may be accepted here once the count is sent.
+        if (accepting)
+            stopAcceptors();
+        struct UpgradeHandoff handoff = {UPGRADE_MAGIC, getpid(),
+                                         atomic_load(&games_accepted),
+                                         num_listeners, ticket_key};
+        if (sendListeners(successor_fd, listeners, &handoff)) {
+            handed_over = true;
+            return true;
+        }
+        if (accepting && startAcceptors(clients) != EXIT_SUCCESS)
+            server_shutdown = 1;
+    }
+    logText(&logger, "MAIN: server %d did not take over; carrying on\n",
+            successor);
+    close(successor_fd);
+    successor_fd = -1;
+    kill(successor, SIGUSR1);
+    waitpid(successor, NULL, 0);
+    return false;
+}
+
+void closeListeners() {
+    for (int i = 0; i < num_listeners; i++)
+        close(*(listeners + i));
+    num_listeners = 0;
+}
 
-    printf("MAIN: Wordle server listening on port {%d}\n", tcp_port);
+// Opens the listening sockets on port: one SO_REUSEPORT socket for each of
+// count acceptors, or just the one if count is 0.
+// Returns false on error, with none of them left open.
+bool openListeners(unsigned short port, int backlog, int count) {
+    logText(&logger, "MAIN: Wordle server listening on port {%d}\n", port);
 
     // populating socket structure
     struct sockaddr_in tcp_server;
@@ -601,125 +2857,458 @@ int wordle_server(int argc, char **argv) {
 #else
     tcp_server.sin_addr.s_addr = htonl(INADDR_ANY);
 #endif
-    tcp_server.sin_port = htons(tcp_port);
+    tcp_server.sin_port = htons(port);
+
+    for (num_listeners = 0; num_listeners < (count > 0 ? count : 1);
+         num_listeners++) {
+        int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int on = 1;
+        if (listener == -1) {
+            perror("ERROR: socket() failed");
+            closeListeners();
+            return false;
+        }
 
-    if (bind(listener, (struct sockaddr *)&tcp_server, sizeof(tcp_server)) ==
-        -1) {
-        perror("ERROR: bind() failed");
-        for (int i = 0; i < dict_size; i++) {
-            free(*(dict + i));
+        if (count > 0 && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &on,
+                                    sizeof(on)) == -1) {
+            perror("ERROR: setsockopt() failed");
+            close(listener);
+            closeListeners();
+            return false;
         }
 
-        free(dict);
+        if (bind(listener, (struct sockaddr *)&tcp_server,
+                 sizeof(tcp_server)) == -1) {
+            perror("ERROR: bind() failed");
+            close(listener);
+            closeListeners();
+            return false;
+        }
 
-        return EXIT_FAILURE;
+        // The backlog is capped by net.core.somaxconn; a short one drops
+        // SYNs while the acceptors are busy.
+        if (listen(listener, backlog) == -1) {
+            perror("listen() failed");
+            close(listener);
+            closeListeners();
+            return false;
+        }
+        *(listeners + num_listeners) = listener;
     }
+    return true;
+}
+
+// Takes the listening sockets over from the server that started this one,
+// and starts waiting for its totals.
+// Returns false on error.
+bool takeOverListeners() {
+    struct UpgradeHandoff handoff;
+    num_listeners = receiveListeners(predecessor_fd, &handoff, listeners);
+    if (num_listeners == -1) {
+        num_listeners = 0;
+        return false;
+    }
+    predecessor = handoff.pid;
+    atomic_store(&games_accepted, handoff.games_accepted);
+    ticket_key = handoff.ticket_key;
+    logText(&logger, "MAIN: took over from server %d\n", predecessor);
+
+    int rc = spawnHelper(&inherit_thread, inheritTotals, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n", rc);
+        closeListeners();
+        return false;
+    }
+    return true;
+}
+
+int wordle_server(int argc, char **argv) {
+    struct sigaction kill_action, ign_action;
+    kill_action.sa_handler = killServer;
+    sigemptyset(&kill_action.sa_mask);
+    kill_action.sa_flags = 0;
+    ign_action.sa_handler = SIG_IGN;
+    sigemptyset(&ign_action.sa_mask);
+    ign_action.sa_flags = 0;
+
+    sigaction(SIGINT, &ign_action, NULL);
+    sigaction(SIGTERM, &ign_action, NULL);
+    sigaction(SIGHUP, &kill_action, NULL);
+    sigaction(SIGUSR2, &kill_action, NULL);
+    sigaction(SIGUSR1, &kill_action, NULL);
 
-    // be prepared to have to change this 5. there is nothing about it in the
-    // pdf...
-    if (listen(listener, 5) == -1) {
-        perror("listen() failed");
-        for (int i = 0; i < dict_size; i++) {
-            free(*(dict + i));
+    // SIGUSR2 and SIGHUP are only let through while the accept loop waits in
+    // ppoll(), so every thread started from here on has them blocked.
+    sigset_t loop_mask, accept_mask;
+    sigemptyset(&loop_mask);
+    sigaddset(&loop_mask, SIGUSR2);
+    sigaddset(&loop_mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &loop_mask, &accept_mask);
+    sigdelset(&accept_mask, SIGUSR2);
+    sigdelset(&accept_mask, SIGHUP);
+    server_argv = argv;
+
+    int opt;
+    int server_threads = 0;
+    int queue_size = DEFAULT_QUEUE_SIZE;
+    char *word_log_fn = NULL;
+    int acceptor_count = 0;
+    int backlog = DEFAULT_BACKLOG;
+    int rc;
+    logger.policy = LOG_BLOCK;
+    while ((opt = getopt(argc, argv, "a:b:B:G:H:j:K:l:L:m:n:p:q:S:T:U:w:")) !=
+           -1) {
+        switch (opt) {
+        case 'a':
+            if (sscanf(optarg, "%d", &acceptor_count) != 1 ||
+                acceptor_count < 1 || acceptor_count > MAX_ACCEPTORS)
+                return badInput();
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d", &backlog) != 1 || backlog < 1)
+                return badInput();
+            break;
+        case 'B':
+            if (sscanf(optarg, "%d", &socket_buffer) != 1 ||
+                socket_buffer < 1)
+                return badInput();
+            break;
+        case 'G':
+            if (sscanf(optarg, "%d", &slab_games) != 1 || slab_games < 1)
+                return badInput();
+            break;
+        case 'U':
+            // Only given by a server starting its own replacement.
+            if (sscanf(optarg, "%d", &predecessor_fd) != 1 ||
+                predecessor_fd < 0)
+                return badInput();
+            break;
+        case 'l':
+            if (strcmp(optarg, "off") == 0)
+                logger.level = LOG_OFF;
+            else if (strcmp(optarg, "info") == 0)
+                logger.level = LOG_INFO;
+            else if (strcmp(optarg, "debug") == 0)
+                logger.level = LOG_DEBUG;
+            else
+                return badInput();
+            break;
+        case 'L':
+            if (strcmp(optarg, "sync") == 0)
+                logger.policy = LOG_SYNC;
+            else if (strcmp(optarg, "block") == 0)
+                logger.policy = LOG_BLOCK;
+            else if (strcmp(optarg, "drop") == 0)
+                logger.policy = LOG_DROP;
+            else
+                return badInput();
+            break;
+        case 'm':
+            if (strcmp(optarg, "threads") == 0)
+                mode = MODE_THREADS;
+            else if (strcmp(optarg, "pool") == 0)
+                mode = MODE_POOL;
+            else if (strcmp(optarg, "epoll") == 0)
+                mode = MODE_EPOLL;
+#ifdef HAVE_IO_URING
+            else if (strcmp(optarg, "uring") == 0)
+                mode = MODE_URING;
+#endif
+            else
+                return badInput();
+            break;
+        case 'n':
+            if (sscanf(optarg, "%d", &server_threads) != 1 ||
+                server_threads < 1)
+                return badInput();
+            break;
+        case 'q':
+            if (sscanf(optarg, "%d", &queue_size) != 1 || queue_size < 1)
+                return badInput();
+            break;
+        case 'H':
+            if (sscanf(optarg, "%d", &hint_threads) != 1 || hint_threads < 0)
+                return badInput();
+            break;
+        case 'j':
+            journal_fn = optarg;
+            break;
+        case 'K':
+            ticket_key_fn = optarg;
+            break;
+        case 'p':
+            matrix_fn = optarg;
+            break;
+        case 'S':
+            latency_name = optarg;
+            break;
+        case 'T':
+            if (strcmp(optarg, "nagle") == 0)
+                send_mode = SEND_NAGLE;
+            else if (strcmp(optarg, "nodelay") == 0)
+                send_mode = SEND_NODELAY;
+            else if (strcmp(optarg, "cork") == 0)
+                send_mode = SEND_CORK;
+            else
+                return badInput();
+            break;
+        case 'w':
+            word_log_fn = optarg;
+            break;
+        default:
+            return badInput();
         }
+    }
+
+    if (argc - optind != 4 || (mode == MODE_URING && acceptor_count > 0)) {
+        return badInput();
+    }
+    // So the positional arguments are at argv + 1 through argv + 4.
+    argv += optind - 1;
+
+    if (server_threads == 0) {
+        server_threads =
+            mode == MODE_EPOLL ? DEFAULT_REACTORS : DEFAULT_WORKERS;
+    }
+
+    unsigned short tcp_port;
+    if (sscanf(*(argv + 1), "%hd", &tcp_port) == EOF) {
+        return badInput();
+    }
+
+    unsigned int seed;
+    if (sscanf(*(argv + 2), "%u", &seed) == EOF) {
+        return badInput();
+    }
+
+    if (sscanf(*(argv + 3), "%256s", dictionary_fn) == EOF) {
+        return badInput();
+    }
+
+    if (sscanf(*(argv + 4), "%d", &dict_size) != 1 || dict_size < 1 ||
+        dict_size > DICT_MAX_WORDS) {
+        return badInput();
+    }
+
+    // SIGHUP loads it again, from the same files.
+    struct GameData *data = loadGameData();
+    if (data == NULL)
+        return EXIT_FAILURE;
+    atomic_store(&game_data, data);
+
+    game_seed = seed;
+    // A server taking over is handed the old one's key instead.
+    if (ticket_key_fn != NULL ? !readTicketKey(ticket_key_fn, &ticket_key)
+                              : !randomTicketKey(&ticket_key)) {
+        freeGameData(data);
+        return EXIT_FAILURE;
+    }
+    if (!randomTicketKey(&token_key)) {
+        freeGameData(data);
+        return EXIT_FAILURE;
+    }
+    logText(&logger, "MAIN: seeded pseudo-random number generator with %d\n",
+            seed);
+
+    // Start server setup
 
-        free(dict);
+    bool listening = predecessor_fd != -1
+                         ? takeOverListeners()
+                         : openListeners(tcp_port, backlog, acceptor_count);
+    if (!listening) {
+        freeGameData(data);
         return EXIT_FAILURE;
     }
+    // Whatever the old server was accepting on, this one carries on with.
+    if (acceptor_count > 0 || num_listeners > 1)
+        acceptor_count = num_listeners;
     // Presumably the rest of this is application protocol
 
-    struct sockaddr_in remote_client;
-    int addrlen = sizeof(remote_client);
-    int rc;
+    if (latency_name != NULL) {
+        latency = openLatency(latency_name);
+        if (latency == NULL) {
+            freeGameData(data);
+            return EXIT_FAILURE;
+        }
+        logText(&logger, "MAIN: publishing latencies to shared memory %s\n",
+                latency_name);
+    }
 
-    struct args *thread_args = calloc(1, sizeof(struct args));
+    // The old server keeps spilling to its file until it exits, so this one
+    // starts a new file under the same name instead of emptying that one.
+    if (predecessor_fd != -1 && word_log_fn != NULL)
+        unlink(word_log_fn);
+    if (!newWordLog(&word_log, word_log_fn)) {
+        if (latency != NULL)
+            closeLatency(latency, latency_name);
+        freeGameData(data);
+        return EXIT_FAILURE;
+    }
 
-    // Initialize the list...
-    struct List *current_threads = newList();
-    mutex_list = &current_threads->mutex;
-    global_thread_list = current_threads;
-    int sd;
-    pthread_t new_thread;
+    // A server that was started again picks up the journal where the last
+    // one left it. One taking over from another gets that one's totals
+    // instead, and shares the journal with it until it exits.
+    if (journal_fn != NULL) {
+        journal_on = openJournal(&journal, journal_fn);
+        if (journal_on && predecessor_fd == -1 &&
+            !recoverJournal(&journal, &word_log, &recovered))
+            closeGameJournal();
+        if (!journal_on) {
+            freeWordLog(&word_log);
+            if (latency != NULL)
+                closeLatency(latency, latency_name);
+            freeGameData(data);
+            return EXIT_FAILURE;
+        }
+    }
+    if (journal_on && predecessor_fd == -1) {
+        addStat(&stats, STAT_GUESSES, recovered.guesses);
+        addStat(&stats, STAT_WINS, recovered.wins);
+        addStat(&stats, STAT_LOSSES, recovered.losses);
+        logText(&logger,
+                "MAIN: recovered %ld game%s from journal %s (%d to resume)\n",
+                recovered.games, recovered.games == 1 ? "" : "s", journal_fn,
+                recovered.num_open);
+    }
+
+    rc = startLogger(&logger);
+    if (rc == EXIT_SUCCESS && journal_on)
+        rc = startJournal(&journal);
+    if (rc != EXIT_SUCCESS) {
+        stopLogger(&logger);
+        closeGameJournal();
+        freeWordLog(&word_log);
+        if (latency != NULL)
+            closeLatency(latency, latency_name);
+        freeGameData(data);
+        return EXIT_FAILURE;
+    }
+
+    // The connections that have a game thread of their own.
+    struct Registry *clients = newRegistry();
+    if (clients == NULL) {
+        fprintf(stderr, "ERROR: calloc() failed\n");
+        stopLogger(&logger);
+        closeGameJournal();
+        freeWordLog(&word_log);
+        if (latency != NULL)
+            closeLatency(latency, latency_name);
+        freeGameData(data);
+        return EXIT_FAILURE;
+    }
+
+    if (startReloader() != EXIT_SUCCESS) {
+        cleanupServer(clients);
+        return EXIT_FAILURE;
+    }
+
+#ifdef HAVE_IO_URING
+    if (mode == MODE_URING) {
+        logText(&logger, "MAIN: serving with io_uring\n");
+        rc = runUring(*listeners);
+        if (signalled)
+            logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+        cleanupServer(clients);
+        return rc;
+    }
+#endif
+
+    if (mode == MODE_EPOLL) {
+        if (startReactors(server_threads) != 0) {
+            cleanupServer(clients);
+            return EXIT_FAILURE;
+        }
+        logText(&logger, "MAIN: started %d event loop thread%s\n",
+                server_threads, server_threads == 1 ? "" : "s");
+    } else if (mode == MODE_POOL) {
+        if (startPool(server_threads, queue_size) != 0) {
+            cleanupServer(clients);
+            return EXIT_FAILURE;
+        }
+        logText(&logger, "MAIN: started %d worker thread%s\n",
+                server_threads, server_threads == 1 ? "" : "s");
+    }
+
+    if (acceptor_count > 0) {
+        if (startAcceptors(clients) != EXIT_SUCCESS) {
+            cleanupServer(clients);
+            return EXIT_FAILURE;
+        }
+        logText(&logger, "MAIN: started %d acceptor thread%s\n",
+                acceptor_count, acceptor_count == 1 ? "" : "s");
+    }
 
     // Dont accept any new connections if the server has been killed,
     // if the server is signalled in the middle of a loop
     // any new threads created will terminate without taking input.
-    fd_set listener_set;
+    // With acceptor threads, this just waits for signals and for them.
+    // ppoll() rather than pselect(): the successor's socket is made once
+    // SIGUSR2 comes in, and by then it can be past FD_SETSIZE.
+    struct pollfd waits[2];
+    int listener = num_acceptors > 0 ? acceptor_pipe[0] : *listeners;
     while (!server_shutdown) {
-        // Select until the socket is ready, We dont want to hang on the accept
-        // call if the server gets shut down.
-        FD_ZERO(&listener_set);
-        FD_SET(listener, &listener_set);
-        rc = select(FD_SETSIZE, &listener_set, NULL, NULL, NULL);
+        // Poll until the socket is ready, We dont want to hang on the accept
+        // call if the server gets shut down. SIGUSR2 and SIGHUP only get
+        // through here.
+        waits[0] = (struct pollfd){.fd = listener, .events = POLLIN};
+        waits[1] = (struct pollfd){.fd = successor_fd, .events = POLLIN};
+        rc = ppoll(waits, successor_fd != -1 ? 2 : 1, NULL, &accept_mask);
         if (rc == -1) {
             if (errno != EINTR) {
                 // errno == EINTR if a signal is caught (i.e. SIGUSR1)
-                perror("ERROR: select() failed");
-                cleanupServer(dict, dict_size, thread_args, current_threads);
+                perror("ERROR: ppoll() failed");
+                cleanupServer(clients);
                 return EXIT_FAILURE;
             } else if (server_shutdown) {
                 break;
+            } else if (upgrade_requested || reload_requested) {
+                if (upgrade_requested) {
+                    upgrade_requested = false;
+                    startUpgrade();
+                }
+                if (reload_requested) {
+                    reload_requested = false;
+                    logText(&logger,
+                            "MAIN: SIGHUP rcvd; reloading the dictionary\n");
+                    sem_post(&reload_sem);
+                }
+                continue;
             } else {
-                cleanupServer(dict, dict_size, thread_args, current_threads);
+                cleanupServer(clients);
                 return EXIT_FAILURE;
             }
         }
 
-        // we should no longer block on accept
-        sd = accept(listener, (struct sockaddr *)&remote_client,
-                    (socklen_t *)&addrlen);
-        if (sd == -1) {
-            perror("ERROR: accept() failed");
-
-            cleanupServer(dict, dict_size, thread_args, current_threads);
-            return EXIT_FAILURE;
-        }
-
-        printf("MAIN: rcvd incoming connection request\n");
-
-        pthread_mutex_lock(&mutex_targs);
-        {
-            thread_args->csd = sd;
-            thread_args->dictionary = dict;
-            thread_args->dict_len = dict_size;
-            thread_args->thread_list = current_threads;
-        }
-        pthread_mutex_unlock(&mutex_targs);
-
-        if (server_shutdown) {
+        if (successor_fd != -1 && waits[1].revents != 0) {
+            if (!handOver(clients)) {
+                // The acceptors may have been restarted, on a new pipe.
+                listener = num_acceptors > 0 ? acceptor_pipe[0] : *listeners;
+                continue;
+            }
+            logText(&logger, "MAIN: handed the listener to server %d\n",
+                    successor);
+            closeListeners();
+            // The new server has a segment of its own under the same name.
+            latency_name = NULL;
+            drainServer(clients);
             if (signalled)
-                printf("MAIN: SIGUSR1 rcvd; Wordle server shutting down...\n");
-
-            cleanupServer(dict, dict_size, thread_args, current_threads);
+                logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+            cleanupServer(clients);
             return EXIT_SUCCESS;
         }
+        if (waits[0].revents == 0)
+            continue;
 
-        rc = pthread_create(&new_thread, NULL, do_on_thread, thread_args);
-
-        if (rc != 0) {
-            fprintf(stderr, "ERROR: pthread_create() failed with code: %d\n",
-                    rc);
-
-            cleanupServer(dict, dict_size, thread_args, current_threads);
-            return EXIT_FAILURE;
-        }
-        // Finally, detach the thread so we dont need to join it anymore.
-        if (pthread_detach(new_thread) != 0) {
-            fprintf(stderr, "ERROR: pthread_detach failed()\n");
-
-            cleanupServer(dict, dict_size, thread_args, current_threads);
+        // An acceptor only writes to the pipe if it hit an error.
+        if (num_acceptors > 0 || !acceptConn(listener, clients)) {
+            cleanupServer(clients);
             return EXIT_FAILURE;
         }
-
-        // Threads are allowed to remove themselves from the list on
-        //  termination, so a mutex is necessary.
-
-        push_back(current_threads, sd, new_thread);
     }
 
     // (server_shutdown == true);
     if (signalled)
-        printf("MAIN: SIGUSR1 rcvd; Wordle server shutting down...\n");
-    cleanupServer(dict, dict_size, thread_args, current_threads);
+        logEvent(&logger, LOG_SHUTDOWN, NULL, 0);
+    cleanupServer(clients);
     return EXIT_SUCCESS;
 }